@@ -1,9 +1,55 @@
+#include <map>
+#include <set>
+#include <list>
+#include <array>
 #include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <future>
+#include <fstream>
+#include <functional>
+#include <numeric>
 #include <iostream>
+#include <algorithm>
+#include <type_traits>
+#include <string_view>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+#include <limits.h>
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX            // keeps min/max macros from breaking std::min, std::max and ::max()
+#endif
 #include <windows.h>
+#include <malloc.h>
+#else
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <poll.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "cppcli.hpp"
 
 using String = std::string;
 
@@ -12,23 +58,130 @@ static inline String to_string(T var) {
     return std::to_string(var);
 }
 
-static inline String generate_tcode(const char * axis, char pos) {
-    
-    static char tcode[8];
+#define OSR_TCODE_CAPACITY 96
+
+struct OSR_TCODE_FRAME
+{
+    unsigned long timestamp;    //ms, when the frame was produced
+    int length;
+    char tcode[OSR_TCODE_CAPACITY];
+};
+
+// Appends one axis command without the heap, a command that does not fit is dropped whole.
+static inline bool append_tcode(OSR_TCODE_FRAME& frame, const char * axis, char pos, int interval = 0) {
 
     if (pos > 99) pos = 99;
     if (pos < 0) pos = 0;
 
-    memset(tcode, 0, sizeof(tcode));
-    sprintf(tcode, "%s%04d ", axis, pos * 100);
+    int room = OSR_TCODE_CAPACITY - frame.length;
+    int written = interval > 0
+        ? snprintf(frame.tcode + frame.length, room, "%s%04dI%d ", axis, pos * 100, interval)
+        : snprintf(frame.tcode + frame.length, room, "%s%04d ", axis, pos * 100);
+
+    if (written < 0 || written >= room)
+    {
+        frame.tcode[frame.length] = 0;
+        return false;
+    }
+
+    frame.length += written;
+    return true;
+}
+
+#define OSR_FIXED_SHIFT 12
+#define OSR_FIXED_ONE (1 << OSR_FIXED_SHIFT)
+
+typedef enum _TCODE_INTERP_MODE_
+{
+    TCODE_INTERP_LINEAR,
+    TCODE_INTERP_CUBIC,     // hermite with flat tangents, eases in and out of every keyframe
+}TCODE_INTERP_MODE;
+
+// Integer only so the same code runs on an FPU-less MCU, t/span is carried in Q12.
+static inline char interpolate_motion(char from, char to, long t, long span, TCODE_INTERP_MODE mode) {
+
+    if (span <= 0 || t >= span)
+        return to;
+    if (t <= 0)
+        return from;
+
+    int s = int((t << OSR_FIXED_SHIFT) / span);
+
+    if (mode == TCODE_INTERP_CUBIC)
+    {
+        int s2 = (s * s) >> OSR_FIXED_SHIFT;
+        int s3 = (s2 * s) >> OSR_FIXED_SHIFT;
+        s = 3 * s2 - 2 * s3;
+    }
 
-    return String(tcode);
+    return char(from + (((to - from) * s + OSR_FIXED_ONE / 2) >> OSR_FIXED_SHIFT));
 }
 
+#ifdef _WIN32
+
+static inline unsigned long long get_curr_time_us() {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (unsigned long long)(now.QuadPart / freq.QuadPart * 1000000 + now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+};
+
+// Same source as get_curr_time_us() so both clocks share an origin, GetTickCount only ticks every ~16ms.
+static inline unsigned long get_curr_time_ms() {
+    return (unsigned long)(get_curr_time_us() / 1000);
+};
+
+static inline size_t get_page_size() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+};
+
+static inline void * alloc_pages(size_t bytes) {
+    return _aligned_malloc(bytes, get_page_size());
+};
+
+static inline void free_pages(void * pages) {
+    _aligned_free(pages);
+};
+
+#else
+
 static inline unsigned long get_curr_time_ms() {
-    return GetTickCount();
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)(ts.tv_sec * 1000UL + ts.tv_nsec / 1000000);
+};
+
+static inline unsigned long long get_curr_time_us() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+};
+
+static inline void Sleep(unsigned long ms) {
+    usleep(ms * 1000);
+};
+
+static inline size_t get_page_size() {
+    return size_t(sysconf(_SC_PAGESIZE));
+};
+
+static inline void * alloc_pages(size_t bytes) {
+    void * pages = nullptr;
+    return posix_memalign(&pages, get_page_size(), bytes) == 0 ? pages : nullptr;
+};
+
+static inline void free_pages(void * pages) {
+    free(pages);
 };
 
+#endif
+
+typedef unsigned long long (*OSR_CLOCK_US)();
+
 
 struct OSRSB_Header
 {
@@ -88,283 +241,4510 @@ typedef enum _OSRSB_MOTION_TYPE_
     OSRSB_MOTION_UNKNOWN,
 }OSRSB_MOTION_TYPE;
 
-
-class OSR_SCRIPT
+struct OSRSB_Segment
 {
-    typedef enum _SCRIPT_PLAY_STATE_
-    {
-        SCRIPT_STOPPED,
-        SCRIPT_PAUSED,
-        SCRIPT_PLAYING,
-    }SCRIPT_PLAY_STATE;
-
-private:
+    int from_frame;
+    int to_frame;
+    char from_pos;
+    char to_pos;
+};
 
-    FILE* _file;
-    String _path;
-    OSRSB_Header _header;
-    OSRSB_Body * _buffer;
-    
-    int _file_pos;
-    int _file_size;
-    int _frame_pos;
-    int _last_frame_pos;
-    int _start_frame_pos;
-    unsigned long _start_time;
+typedef enum _TCODE_OUTPUT_MODE_
+{
+    TCODE_OUTPUT_FULL,      // every axis with a keyframe, every frame
+    TCODE_OUTPUT_DELTA,     // only axes that moved beyond the dead band
+    TCODE_OUTPUT_INTERVAL,  // one move per keyframe, interpolated by the device
+}TCODE_OUTPUT_MODE;
 
-    int _buffer_length;
-    int _buffer_start_frame_pos;
+// Axes fixed at compile time, for_each() is a fold so the per-axis code is unrolled and an
+// axis that is not listed costs nothing.
+template<OSRSB_MOTION_TYPE... AXES>
+struct OSR_AXIS_SET
+{
+    static_assert(sizeof...(AXES) > 0, "OSR_AXIS_SET needs at least one axis");
 
-    int _interval;
-    bool _validation;
-    SCRIPT_PLAY_STATE _state;
+    template<typename F>
+    static inline void for_each(F&& f) {
+        (f(std::integral_constant<OSRSB_MOTION_TYPE, AXES>()), ...);
+    }
+};
 
+typedef OSR_AXIS_SET<OSRSB_MOTION_STROKE, OSRSB_MOTION_PITCH, OSRSB_MOTION_ROLL, OSRSB_MOTION_TWIST> OSR_AXES_DEFAULT;
+typedef OSR_AXIS_SET<OSRSB_MOTION_STROKE> OSR_AXES_STROKE;
+typedef OSR_AXIS_SET<OSRSB_MOTION_STROKE, OSRSB_MOTION_SURGE, OSRSB_MOTION_SWAY,
+    OSRSB_MOTION_TWIST, OSRSB_MOTION_ROLL, OSRSB_MOTION_PITCH> OSR_AXES_SR6;
 
-    bool _parse_script_bin() {
+// The axis is a template argument so that the TCode letter and the body field are picked at
+// compile time, for_each() hands it over as an integral_constant.
+template<OSRSB_MOTION_TYPE A>
+static inline const char * get_tcode_axis() {
 
-        _file = fopen(_path.c_str(), "rb"); 
-        if (_file == NULL) {
-            perror((String("Error opening file: ") + _path).c_str());
-            return false;
-        }
+    static_assert(A >= OSRSB_MOTION_STROKE && A < OSRSB_MOTION_UNKNOWN, "no TCode axis for this motion type");
 
-        size_t bytesRead = fread(&_header, 1, sizeof(OSRSB_Header), _file);
-        if (bytesRead != sizeof(OSRSB_Header)) {
-            perror((String("Error parsing file: ") + _path).c_str());
-            return false;
-        }
+    if constexpr (A == OSRSB_MOTION_STROKE) return "L0";
+    else if constexpr (A == OSRSB_MOTION_PITCH) return "R2";
+    else if constexpr (A == OSRSB_MOTION_ROLL) return "R1";
+    else if constexpr (A == OSRSB_MOTION_TWIST) return "R0";
+    else if constexpr (A == OSRSB_MOTION_SURGE) return "L1";
+    else return "L2";
+}
 
-        _file_pos = ftell(_file);
-        fseek(_file, 0, SEEK_END); 
-        _file_size = ftell(_file);
-        fseek(_file, _file_pos, SEEK_SET);
+template<OSRSB_MOTION_TYPE A>
+static inline char get_motion_value(const OSRSB_Body& act) {
 
-        _interval = _header.interval;
+    static_assert(A >= OSRSB_MOTION_STROKE && A < OSRSB_MOTION_UNKNOWN, "no body field for this motion type");
 
-        return _header.frame * sizeof(OSRSB_Body) + sizeof(OSRSB_Header) == _file_size;
-    };
+    if constexpr (A == OSRSB_MOTION_STROKE) return act.stroke;
+    else if constexpr (A == OSRSB_MOTION_PITCH) return act.pitch;
+    else if constexpr (A == OSRSB_MOTION_ROLL) return act.roll;
+    else if constexpr (A == OSRSB_MOTION_TWIST) return act.twist;
+    else if constexpr (A == OSRSB_MOTION_SURGE) return act.ext.attr.surge;
+    else return act.ext.attr.sway;
+}
 
-    void _load_from_script_bin() {
 
-        long file_pos = _buffer_start_frame_pos * sizeof(OSRSB_Body) + sizeof(OSRSB_Header);
-        fseek(_file, file_pos, SEEK_SET);
-        size_t bytesRead = fread(_buffer, 1, _buffer_length * sizeof(OSRSB_Body), _file);
-        if (bytesRead == 0) {
-            perror((String("Error reading file: ") + _path + String(" at pos: ") + to_string(file_pos)).c_str());
-            memset(_buffer, -1, _buffer_length * sizeof(OSRSB_Body));
-        }
-    };
+// Log-linear histogram of microsecond values: exact below 32us, then 16 linear steps per
+// power of two, so any percentile is within 1/16 of the true value. Buckets are relaxed
+// atomics, one thread records while any other reads.
+class OSR_LATENCY_HISTOGRAM
+{
+    enum { SUB_BITS = 4, SUB = 1 << SUB_BITS, MAX_BITS = 40, BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB };
 
-    OSRSB_Body _get_current_motion() {
+    std::atomic<unsigned> _buckets[BUCKETS];
+    std::atomic<unsigned long long> _count;
+    std::atomic<unsigned long long> _max;
 
-        OSRSB_Body act;
+    static int _index(unsigned long long v) {
 
-        int buffer_pos = _frame_pos - _buffer_start_frame_pos;
+        if (v < 2 * SUB)
+            return int(v);
+        if (v >> MAX_BITS)
+            v = (1ULL << MAX_BITS) - 1;
 
-        if (buffer_pos < _buffer_length)
-            act = _buffer[buffer_pos];
-        else
-        {
-            _buffer_start_frame_pos = _frame_pos;
-            _load_from_script_bin();
-            act = _buffer[0];
-        }
+        int msb = 2 * SUB_BITS;
+        while (v >> (msb + 1))
+            msb++;
 
-        return act;
+        int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB + int((v >> shift) & (SUB - 1));
     };
 
-    String _transfer_into_tcode(OSRSB_Body& act) {
+    // Largest value that lands in the bucket.
+    static unsigned long long _upper(int index) {
 
-        String tcode;
-
-        if (act.stroke != -1)
-            tcode += generate_tcode("L0", act.stroke);
-
-        if (act.pitch != -1)
-            tcode += generate_tcode("R2", act.pitch);
-
-        if (act.roll != -1)
-            tcode += generate_tcode("R1", act.roll);
+        if (index < 2 * SUB)
+            return index;
 
-        if (act.twist != -1)
-            tcode += generate_tcode("R0", act.twist);
-        
-        return tcode;
+        int shift = index / SUB - 1;
+        return ((unsigned long long)(SUB + index % SUB) << shift) + (1ULL << shift) - 1;
     };
 
 public:
 
-    OSR_SCRIPT(String path, int buffer_length = 128) {
+    OSR_LATENCY_HISTOGRAM() {
+        reset();
+    }
 
-        _path = path;
-        _file_pos = 0;
-        _frame_pos = 0;
-        _buffer = nullptr;
-        _start_frame_pos = 0;
-        _last_frame_pos = -1;
-        _state = SCRIPT_STOPPED;
-        _buffer_length = buffer_length;
-        _buffer_start_frame_pos = 0;
+    void record(unsigned long long us) {
 
-        _validation = _parse_script_bin();
+        _buckets[_index(us)].fetch_add(1, std::memory_order_relaxed);
+        _count.fetch_add(1, std::memory_order_relaxed);
 
+        unsigned long long max = _max.load(std::memory_order_relaxed);
+        while (us > max && !_max.compare_exchange_weak(max, us, std::memory_order_relaxed));
     }
 
-    ~OSR_SCRIPT() {
+    // Not atomic as a whole, a concurrent record() may or may not be counted.
+    void reset() {
+        for (int cnt(0); cnt < BUCKETS; cnt++)
+            _buckets[cnt].store(0, std::memory_order_relaxed);
+        _count.store(0, std::memory_order_relaxed);
+        _max.store(0, std::memory_order_relaxed);
+    }
 
-        if(_buffer)
-        {
-            delete _buffer;
-            _buffer = nullptr;
-        }
-        
-        fclose(_file);
+    unsigned long long count() const {
+        return _count.load(std::memory_order_relaxed);
     }
 
-    void rewind(){
-        set_pos(0);
+    unsigned long long max() const {
+        return _max.load(std::memory_order_relaxed);
     }
 
-    void set_pos(int pos) {
-        _frame_pos = pos;
-        _start_frame_pos = _frame_pos;
-        _load_from_script_bin();
-    };
+    // Upper bound of the bucket holding the given fraction of samples, e.g. 0.99.
+    unsigned long long percentile(double fraction) const {
 
-    int get_pos() {
-        return _frame_pos;
-    };
+        unsigned long long total = 0;
+        for (int cnt(0); cnt < BUCKETS; cnt++)
+            total += _buckets[cnt].load(std::memory_order_relaxed);
+        if (total == 0)
+            return 0;
 
-    void play(){
+        unsigned long long rank = (unsigned long long)ceil(fraction * total);
+        if (rank < 1)
+            rank = 1;
 
-        if(_validation && !_buffer)
+        unsigned long long seen = 0;
+        for (int cnt(0); cnt < BUCKETS; cnt++)
         {
-            _buffer = new OSRSB_Body[buffer_length];
-            _load_from_script_bin();
+            seen += _buckets[cnt].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return std::min(_upper(cnt), max());
         }
+        return max();
+    }
+};
 
-        _state = SCRIPT_PLAYING;
-        _start_frame_pos = _frame_pos;
-        _start_time = get_curr_time_ms();
+// Lock-free single producer / single consumer ring, N must be a power of two.
+template<typename T, unsigned N>
+class OSR_SPSC_RING
+{
+    static_assert(N && (N & (N - 1)) == 0, "OSR_SPSC_RING size must be a power of two");
+
+    T _items[N];
+    alignas(64) std::atomic<unsigned> _head;    // next slot to pop, written by the consumer
+    alignas(64) std::atomic<unsigned> _tail;    // next slot to push, written by the producer
+
+public:
+
+    OSR_SPSC_RING() : _head(0), _tail(0) {}
+
+    bool push(const T& item) {
+
+        unsigned tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) == N)
+            return false;
+
+        _items[tail & (N - 1)] = item;
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
     }
 
-    void pause() {
-        _state = SCRIPT_PAUSED;
+    bool pop(T& item) {
+
+        unsigned head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire))
+            return false;
+
+        item = _items[head & (N - 1)];
+        _head.store(head + 1, std::memory_order_release);
+        return true;
     }
 
-    void stop() {
-        rewind();
-        _start_time = 0;
-        _state = SCRIPT_STOPPED;
+    unsigned size() const {
+        return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
     }
 
-    bool vaildate() {
-        return _validation;
+    unsigned capacity() const {
+        return N;
     }
+};
 
-    SCRIPT_PLAY_STATE roll(String& out_tcode){
+struct OSR_FRAME_ITEM
+{
+    long timestamp;                 //ms, script time the frame starts at
+    const OSRSB_Body * frame;       // valid until the generator resumes
+};
 
-        if(!_validation)
-        {
-            out_tcode = String("Invaild Script.");
-            return SCRIPT_STOPPED;
-        }
+struct OSR_TCODE_ITEM
+{
+    unsigned long deadline;         //ms, wall clock time the tcode is due at
+    std::string_view tcode;         // valid until the generator resumes
+};
 
-        if (_state == SCRIPT_PLAYING)
-        {
-            _frame_pos = (get_curr_time_ms() - _start_time) / _interval + _start_frame_pos;
+#if defined(__cpp_impl_coroutine)
 
-            if (_frame_pos <= _header.frame)
-            {
-                if (_last_frame_pos != _frame_pos)
-                {
-                    _last_frame_pos = _frame_pos;
-                    OSRSB_Body act = _get_current_motion();
-                    out_tcode = _transfer_into_tcode(act);
-                }
-                else
-                    out_tcode = String("");
-            }
-            else stop();
+// Lazy sequence produced by a coroutine, each value is handed out by pointer and stays in the
+// coroutine frame until the next step, so nothing is copied. Works with range-for or next().
+template<typename T>
+class OSR_GENERATOR
+{
+public:
+
+    struct promise_type
+    {
+        const T * value = nullptr;
+
+        OSR_GENERATOR get_return_object() {
+            return OSR_GENERATOR(std::coroutine_handle<promise_type>::from_promise(*this));
         }
 
-        return _state;
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        std::suspend_always yield_value(const T& item) noexcept {
+            value = &item;
+            return {};
+        }
     };
 
-    void set_interval(int v) {
-        if (v > 0 && v < 100000)
-        {
-            _interval = v;
-            play();
+    class iterator
+    {
+        std::coroutine_handle<promise_type> _handle;
+
+    public:
+
+        explicit iterator(std::coroutine_handle<promise_type> handle = nullptr) : _handle(handle) {}
+
+        const T& operator*() const { return *_handle.promise().value; }
+        const T * operator->() const { return _handle.promise().value; }
+        bool operator==(std::default_sentinel_t) const { return !_handle || _handle.done(); }
+
+        iterator& operator++() {
+            _handle.resume();
+            return *this;
         }
+    };
+
+private:
+
+    std::coroutine_handle<promise_type> _handle;
+
+    explicit OSR_GENERATOR(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+
+public:
+
+    OSR_GENERATOR(OSR_GENERATOR&& other) noexcept : _handle(other._handle) {
+        other._handle = nullptr;
     }
 
-    int get_interval() {
-        return _interval;
+    OSR_GENERATOR(const OSR_GENERATOR&) = delete;
+    OSR_GENERATOR& operator=(const OSR_GENERATOR&) = delete;
+
+    ~OSR_GENERATOR() {
+        if (_handle)
+            _handle.destroy();
     }
 
-    String inline get_file_path() const {
-        return _path;
+    // Steps to the next value, false once the coroutine has finished.
+    bool next() {
+        if (!_handle || _handle.done())
+            return false;
+        _handle.resume();
+        return !_handle.done();
+    }
+
+    const T& value() const {
+        return *_handle.promise().value;
+    }
+
+    iterator begin() {
+        if (_handle)
+            _handle.resume();
+        return iterator(_handle);
+    }
+
+    std::default_sentinel_t end() {
+        return {};
     }
 };
 
+#endif
 
-int main(int argc, char* argv[])
+struct OSR_TIMING_STATS
 {
-    //std::string input_path(argv[1]);
-    std::string input_path("D:\\workspace\\backup\\(BlobCG)Anis.srbs");
+    unsigned long long frames;      // frames or output steps emitted
+    unsigned long long skipped;     // frames or steps passed over because roll() came too late
+    unsigned long long p50;         //us, lateness against the scheduled emission time
+    unsigned long long p99;
+    unsigned long long p999;
+    unsigned long long max;
+};
 
-    std::cout << "Loading script from: " << input_path << std::endl;
+struct OSR_IO_STATS
+{
+    unsigned long long hits;        // frame lookups served from the buffer
+    unsigned long long misses;      // lookups that had to go to the file
+    unsigned long long loads;       // buffer refills
+    unsigned long long reads;       // fread calls
+    unsigned long long bytes_read;
+    unsigned long long seeks;
+    unsigned long long read_us;     // time blocked in fread
+    unsigned long long max_read_us;
+};
 
-    OSR_SCRIPT osrs(input_path);
-    
-    if(!osrs.vaildate())
-        std::cout << "Script file: " << osrs.get_file_path() << " is not available." << std::endl;
-    else
-    {
-        String tcode;
+// Where OSR_SCRIPT reads the .srbs bytes from.
+class OSR_STORAGE
+{
+public:
+    virtual ~OSR_STORAGE() {}
+    virtual bool open(const char * path) = 0;
+    virtual void close() = 0;
+    virtual long size() = 0;
+    virtual bool seek(long pos) = 0;
+    virtual size_t read(void * out, size_t bytes) = 0;
+};
 
-        std::cout <<"Normal play" << std::endl;
-        osrs.play();
-        for(int cnt(0); cnt < 100 && osrs.roll(tcode); cnt ++)
-        {
-            std::cout << "[" << osrs.get_pos() << "|" << osrs.get_pos() * osrs.get_interval() << "] Tcode:" << tcode << std::endl;
-            Sleep(osrs.get_interval());
-        }
+class OSR_FILE_STORAGE : public OSR_STORAGE
+{
+    FILE* _file;
 
-        std::cout << "Normal play 20ms" << std::endl;
-        osrs.set_interval(20);
-        for (int cnt(0); cnt < 100 && osrs.roll(tcode); cnt++)
-        {
-            std::cout << "[" << osrs.get_pos() << "|" << osrs.get_pos() * osrs.get_interval() << "] Tcode:" << tcode << std::endl;
-            Sleep(osrs.get_interval());
-        }
+public:
 
-        std::cout << "Pause" << std::endl;
-        osrs.pause();
-        for (int cnt(0); cnt < 100 && osrs.roll(tcode); cnt++)
-        {
-            std::cout << "[" << osrs.get_pos() << "|" << osrs.get_pos() * osrs.get_interval() << "] Tcode:" << tcode << std::endl;
-            Sleep(osrs.get_interval());
-        }
+    OSR_FILE_STORAGE() : _file(nullptr) {}
 
-        std::cout << "Normal play 1000ms" << std::endl;
-        osrs.set_interval(1000);
-        osrs.play();
-        for (int cnt(0); cnt < 10 && osrs.roll(tcode); cnt++)
+    ~OSR_FILE_STORAGE() {
+        close();
+    }
+
+    bool open(const char * path) override {
+        close();
+        _file = fopen(path, "rb");
+        return _file != NULL;
+    }
+
+    void close() override {
+        if (_file)
         {
-            std::cout << "[" << osrs.get_pos() << "|" << osrs.get_pos() * osrs.get_interval() << "] Tcode:" << tcode << std::endl;
-            Sleep(osrs.get_interval());
+            fclose(_file);
+            _file = nullptr;
         }
+    }
 
-        std::cout << "Normal play 100ms" << std::endl;
-        osrs.set_pos(0);
-        osrs.set_interval(100);
-        osrs.play();
-        while(osrs.roll(tcode))
-        {
-            std::cout << "[" << osrs.get_pos() << "|" << osrs.get_pos() * osrs.get_interval() << "] Tcode:" << tcode << std::endl;
-            Sleep(osrs.get_interval());
+    long size() override {
+        long pos = ftell(_file);
+        fseek(_file, 0, SEEK_END);
+        long end = ftell(_file);
+        fseek(_file, pos, SEEK_SET);
+        return end;
+    }
+
+    bool seek(long pos) override {
+        return fseek(_file, pos, SEEK_SET) == 0;
+    }
+
+    size_t read(void * out, size_t bytes) override {
+        return fread(out, 1, bytes, _file);
+    }
+};
+
+// Reads .srbs bytes already in memory, e.g. a script built on the fly. The bytes are not owned.
+class OSR_MEMORY_STORAGE : public OSR_STORAGE
+{
+    const char* _data;
+    long _size;
+    long _pos;
+
+public:
+
+    OSR_MEMORY_STORAGE(const void * data, long size) : _data((const char*)data), _size(size), _pos(0) {}
+
+    bool open(const char * path) override {
+        _pos = 0;
+        return _data != nullptr;
+    }
+
+    void close() override {}
+
+    long size() override {
+        return _size;
+    }
+
+    bool seek(long pos) override {
+        if (pos < 0 || pos > _size)
+            return false;
+        _pos = pos;
+        return true;
+    }
+
+    size_t read(void * out, size_t bytes) override {
+        if (bytes > size_t(_size - _pos))
+            bytes = size_t(_size - _pos);
+        memcpy(out, _data + _pos, bytes);
+        _pos += long(bytes);
+        return bytes;
+    }
+};
+
+struct OSR_SD_PROFILE
+{
+    int sector_size;            // bytes, every request transfers whole sectors
+    int cluster_size;           // bytes, entering a cluster other than the last one costs a FAT lookup
+    unsigned request_us;        // command overhead of every read
+    unsigned cluster_us;
+    unsigned bytes_per_sec;     // bus or card throughput, whichever is lower
+    unsigned stall_ppm;         // chance per read of a long-tail stall (wear levelling, GC)
+    unsigned stall_us;          // worst stall, actual ones are spread over [stall_us/4, stall_us]
+    unsigned seed;
+};
+
+// A microSD card on a 4-bit SPI/SDIO bus as seen from a small MCU.
+static inline OSR_SD_PROFILE get_default_sd_profile() {
+
+    OSR_SD_PROFILE profile;
+    profile.sector_size = 512;
+    profile.cluster_size = 32768;
+    profile.request_us = 600;
+    profile.cluster_us = 1500;
+    profile.bytes_per_sec = 2000000;
+    profile.stall_ppm = 2000;
+    profile.stall_us = 120000;
+    profile.seed = 1;
+    return profile;
+}
+
+struct OSR_SD_STATS
+{
+    unsigned long long requests;
+    unsigned long long sectors;
+    unsigned long long clusters;    // cluster changes paid for
+    unsigned long long stalls;
+    unsigned long long busy_us;
+};
+
+// Wraps another storage and charges every read what an SD card would take. The cost is slept
+// away, or when a simulated clock is given, added to it so a benchmark runs at full speed.
+class OSR_SD_STORAGE : public OSR_STORAGE
+{
+    OSR_STORAGE* _inner;
+    OSR_SD_PROFILE _profile;
+    unsigned long long* _sim_clock;
+    OSR_SD_STATS _stats;
+    long _pos;
+    long _last_cluster;
+    unsigned _random;
+
+    unsigned _next_random() {
+        _random = _random * 1103515245 + 12345;
+        return _random >> 8;
+    };
+
+    void _charge(unsigned long long us) {
+
+        _stats.busy_us += us;
+        if (_sim_clock)
+            *_sim_clock += us;
+        else
+        {
+#ifdef _WIN32
+            Sleep(DWORD((us + 999) / 1000));
+#else
+            usleep(useconds_t(us));
+#endif
+        }
+    };
+
+public:
+
+    OSR_SD_STORAGE(OSR_STORAGE* inner, const OSR_SD_PROFILE& profile, unsigned long long* sim_clock = nullptr) {
+        _inner = inner;
+        _profile = profile;
+        _sim_clock = sim_clock;
+        _pos = 0;
+        _last_cluster = -1;
+        _random = profile.seed;
+        memset(&_stats, 0, sizeof(_stats));
+    }
+
+    bool open(const char * path) override {
+        _pos = 0;
+        _last_cluster = -1;
+        return _inner->open(path);
+    }
+
+    void close() override {
+        _inner->close();
+    }
+
+    long size() override {
+        return _inner->size();
+    }
+
+    // Free on the card, the cost is in the next read.
+    bool seek(long pos) override {
+        _pos = pos;
+        return _inner->seek(pos);
+    }
+
+    size_t read(void * out, size_t bytes) override {
+
+        size_t bytes_read = _inner->read(out, bytes);
+        if (bytes == 0)
+            return bytes_read;
+
+        long first = _pos / _profile.sector_size;
+        long last = (_pos + long(bytes) - 1) / _profile.sector_size;
+        long sectors = last - first + 1;
+        long sectors_per_cluster = _profile.cluster_size / _profile.sector_size;
+
+        unsigned long long cost = _profile.request_us
+            + (unsigned long long)sectors * _profile.sector_size * 1000000 / _profile.bytes_per_sec;
+
+        for (long cluster = first / sectors_per_cluster; cluster <= last / sectors_per_cluster; cluster++)
+        {
+            if (cluster == _last_cluster)
+                continue;
+            cost += _profile.cluster_us;
+            _last_cluster = cluster;
+            _stats.clusters++;
+        }
+
+        if (_next_random() % 1000000 < _profile.stall_ppm)
+        {
+            cost += _profile.stall_us / 4 + _next_random() % (_profile.stall_us - _profile.stall_us / 4 + 1);
+            _stats.stalls++;
+        }
+
+        _stats.requests++;
+        _stats.sectors += sectors;
+        _pos += long(bytes_read);
+        _charge(cost);
+
+        return bytes_read;
+    }
+
+    OSR_SD_STATS get_stats() const {
+        return _stats;
+    }
+};
+
+struct OSR_BLOCK_STATS
+{
+    unsigned long long hits;        // blocks served from the cache
+    unsigned long long misses;      // blocks fetched from the inner storage
+    unsigned long long reads;       // transactions issued to the inner storage
+};
+
+// Only ever reads the inner storage in whole blocks at block aligned offsets, one transaction per
+// request at most. Fetched blocks stay in an LRU of configurable size: a few slots are enough for
+// the next, usually overlapping, request to start from memory, a few hundred keep the regions a
+// user scrubs around resident. Block 0 holding the header has a slot of its own.
+class OSR_BLOCK_STORAGE : public OSR_STORAGE
+{
+    OSR_STORAGE* _inner;
+    int _block_size;
+    int _slots;                     // slot 0 is reserved for block 0
+    std::vector<char> _data;
+    std::vector<long> _tags;        // block held by each slot, -1 when empty
+    std::list<int> _lru;            // slots other than 0, most recently used first
+    std::vector<std::list<int>::iterator> _lru_pos;
+    std::map<long, int> _index;     // block to slot, except block 0
+    std::vector<char> _staging;     // a request rounded out to whole blocks
+    long _pos;
+    long _size;
+    OSR_BLOCK_STATS _stats;
+
+    int _find(long block) {
+
+        if (block == 0)
+            return _tags[0] == 0 ? 0 : -1;
+
+        auto found = _index.find(block);
+        return found == _index.end() ? -1 : found->second;
+    };
+
+    int _victim(long block) {
+
+        // Empty slots are never touched, so they stay at the back until used.
+        return block == 0 ? 0 : _lru.back();
+    };
+
+    void _touch(int slot) {
+        if (slot > 0)
+            _lru.splice(_lru.begin(), _lru, _lru_pos[slot]);
+    };
+
+    long _block_end(long block) {
+        long end = (block + 1) * _block_size;
+        return end < _size ? end : _size;
+    };
+
+    // Reads blocks [first, first + count) with a single transaction.
+    size_t _fetch(long first, long count, char * out) {
+
+        long bytes = _block_end(first + count - 1) - first * _block_size;
+
+        _stats.reads++;
+        _stats.misses += count;
+        if (!_inner->seek(first * _block_size))
+            return 0;
+        return _inner->read(out, bytes);
+    };
+
+    void _store(long block, const char * data, long bytes) {
+
+        int slot = _find(block);
+        if (slot < 0)
+        {
+            slot = _victim(block);
+            if (slot > 0)
+            {
+                if (_tags[slot] >= 0)
+                    _index.erase(_tags[slot]);
+                _index[block] = slot;
+            }
+        }
+
+        memcpy(&_data[size_t(slot) * _block_size], data, bytes);
+        _tags[slot] = block;
+        _touch(slot);
+    };
+
+public:
+
+    // blocks is the number of LRU slots next to the one for the header block.
+    OSR_BLOCK_STORAGE(OSR_STORAGE* inner, int block_size = 512, int blocks = 4) {
+        _inner = inner;
+        _block_size = block_size > 0 ? block_size : 512;
+        _slots = (blocks > 0 ? blocks : 1) + 1;
+        _data.resize(size_t(_slots) * _block_size);
+        _tags.assign(_slots, -1);
+        _lru_pos.resize(_slots);
+        for (int slot(1); slot < _slots; slot++)
+            _lru_pos[slot] = _lru.insert(_lru.end(), slot);
+        _pos = 0;
+        _size = -1;
+        memset(&_stats, 0, sizeof(_stats));
+    }
+
+    bool open(const char * path) override {
+        _tags.assign(_slots, -1);
+        _index.clear();
+        _pos = 0;
+        _size = -1;
+        return _inner->open(path);
+    }
+
+    void close() override {
+        _inner->close();
+    }
+
+    long size() override {
+        if (_size < 0)
+            _size = _inner->size();
+        return _size;
+    }
+
+    bool seek(long pos) override {
+        _pos = pos;
+        return pos >= 0;
+    }
+
+    size_t read(void * out, size_t bytes) override {
+
+        char * dest = (char *)out;
+        long end = _pos + long(bytes);
+        if (end > size())
+            end = _size;
+
+        // Leading blocks that are cached, then one transaction for the rest.
+        while (_pos < end)
+        {
+            int slot = _find(_pos / _block_size);
+            if (slot < 0)
+                break;
+
+            long count = (std::min)(_block_end(_pos / _block_size), end) - _pos;
+            memcpy(dest, &_data[size_t(slot) * _block_size + _pos % _block_size], count);
+            _touch(slot);
+            _stats.hits++;
+            dest += count;
+            _pos += count;
+        }
+
+        if (_pos < end)
+        {
+            long first = _pos / _block_size;
+            long last = (end - 1) / _block_size;
+            // The file's last block joins a transaction that reaches the one before it, a short
+            // tail would otherwise cost a request of its own.
+            if (last + 1 == (_size - 1) / _block_size)
+                last++;
+            long span = _block_end(last) - first * _block_size;
+
+            if (long(_staging.size()) < span)
+                _staging.resize(span);
+
+            long got = long(_fetch(first, last - first + 1, &_staging[0]));
+            long valid = (std::min)(got + first * _block_size, end) - _pos;
+            if (valid > 0)
+            {
+                memcpy(dest, &_staging[_pos - first * _block_size], valid);
+                dest += valid;
+                _pos += valid;
+            }
+
+            // Keeps as much of the transaction as fits, the edges last so they survive longest,
+            // they are where the next, usually overlapping, request starts.
+            if (got == span)
+            {
+                for (long index = (std::max)(first + 1, last - (_slots - 3)); index < last; index++)
+                    _store(index, &_staging[(index - first) * _block_size], _block_size);
+                if (first == 0 || first != last)
+                    _store(first, &_staging[0], _block_end(first) - first * _block_size);
+                _store(last, &_staging[(last - first) * _block_size], _block_end(last) - last * _block_size);
+            }
+        }
+
+        return dest - (char *)out;
+    }
+
+    OSR_BLOCK_STATS get_stats() const {
+        return _stats;
+    }
+};
+
+struct OSR_SHARED_CACHE_STATS
+{
+    unsigned long long hits;        // blocks served from memory
+    unsigned long long misses;      // blocks read from a file
+    unsigned long long reads;       // file transactions
+    unsigned long long evictions;
+    size_t bytes;                   // currently cached
+    int files;                      // currently open
+};
+
+// One process-wide, read-only block cache for every OSR_SHARED_STORAGE. Files are keyed by
+// identity (device and inode, volume and file index on Windows), so any number of readers of the
+// same script, under whatever path, share one FILE* and one copy of each block. Files are
+// refcounted and blocks are evicted least recently used first once the byte cap is reached.
+// The cache lock is not held across file reads, blocks being read are marked as loading and
+// other readers of them wait for the load to be published. Scripts are assumed not to change
+// on disk while open.
+class OSR_SHARED_BLOCK_CACHE
+{
+    typedef std::pair<unsigned long long, unsigned long long> _FILE_ID_;
+
+    struct _FILE_
+    {
+        _FILE_ID_ id;
+        int refs;
+        long size;
+        std::mutex io;              // the FILE* is shared, seek and read go together
+        OSR_FILE_STORAGE storage;
+    };
+
+    struct _BLOCK_
+    {
+        _FILE_* file;
+        long index;
+        std::vector<char> data;
+    };
+
+    typedef std::list<_BLOCK_>::iterator _BLOCK_REF_;
+    typedef std::pair<_FILE_*, long> _BLOCK_KEY_;
+
+    std::mutex _mutex;
+    std::condition_variable _loaded;
+    std::map<_FILE_ID_, _FILE_*> _files;
+    std::list<_BLOCK_> _lru;            // most recently used first
+    std::map<_BLOCK_KEY_, _BLOCK_REF_> _blocks;
+    std::set<_BLOCK_KEY_> _loading;     // being read outside the lock
+    int _block_size;
+    size_t _capacity;
+    OSR_SHARED_CACHE_STATS _stats;
+
+    OSR_SHARED_BLOCK_CACHE() {
+        _block_size = 4096;
+        _capacity = 4 << 20;
+        memset(&_stats, 0, sizeof(_stats));
+    }
+
+    static bool _identify(const char * path, _FILE_ID_& id) {
+
+#ifdef _WIN32
+        HANDLE handle = CreateFileA(path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (handle == INVALID_HANDLE_VALUE)
+            return false;
+
+        BY_HANDLE_FILE_INFORMATION info;
+        bool ok = GetFileInformationByHandle(handle, &info) != 0;
+        CloseHandle(handle);
+
+        id.first = info.dwVolumeSerialNumber;
+        id.second = ((unsigned long long)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+        return ok;
+#else
+        struct stat info;
+        if (stat(path, &info) != 0)
+            return false;
+
+        id.first = (unsigned long long)info.st_dev;
+        id.second = (unsigned long long)info.st_ino;
+        return true;
+#endif
+    };
+
+    void _evict(size_t room) {
+
+        while (!_lru.empty() && _stats.bytes + room > _capacity)
+        {
+            _BLOCK_& victim = _lru.back();
+            _stats.bytes -= victim.data.size();
+            _stats.evictions++;
+            _blocks.erase(std::make_pair(victim.file, victim.index));
+            _lru.pop_back();
+        }
+    };
+
+    void _drop(_FILE_* file) {
+
+        for (auto block = _lru.begin(); block != _lru.end();)
+        {
+            if (block->file != file)
+            {
+                ++block;
+                continue;
+            }
+
+            _stats.bytes -= block->data.size();
+            _blocks.erase(std::make_pair(file, block->index));
+            block = _lru.erase(block);
+        }
+    };
+
+    long _block_end(_FILE_* file, long index) {
+        long end = (index + 1) * _block_size;
+        return end < file->size ? end : file->size;
+    };
+
+    // Reads span bytes from the start of block first with one transaction, without the cache lock.
+    static bool _fetch(_FILE_* file, long first, long span, std::vector<char>& staging, int block_size) {
+
+        if (long(staging.size()) < span)
+            staging.resize(span);
+
+        std::lock_guard<std::mutex> io(file->io);
+        return file->storage.seek(first * block_size) && long(file->storage.read(&staging[0], span)) == span;
+    };
+
+    void _publish(_FILE_* file, long first, long count, const std::vector<char>& staging) {
+
+        for (long index = first; index < first + count; index++)
+        {
+            long bytes = _block_end(file, index) - index * _block_size;
+            _evict(bytes);
+
+            const char * data = &staging[(index - first) * _block_size];
+            _lru.push_front(_BLOCK_());
+            _lru.front().file = file;
+            _lru.front().index = index;
+            _lru.front().data.assign(data, data + bytes);
+            _blocks[_BLOCK_KEY_(file, index)] = _lru.begin();
+
+            _stats.bytes += bytes;
+            _stats.misses++;
+        }
+    };
+
+public:
+
+    typedef _FILE_* HANDLE_T;
+
+    static OSR_SHARED_BLOCK_CACHE& instance() {
+        static OSR_SHARED_BLOCK_CACHE cache;
+        return cache;
+    }
+
+    // Only while no file is open.
+    bool configure(int block_size, size_t capacity) {
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_files.empty() || block_size <= 0 || capacity < size_t(block_size))
+            return false;
+
+        _block_size = block_size;
+        _capacity = capacity;
+        return true;
+    }
+
+    HANDLE_T acquire(const char * path) {
+
+        _FILE_ID_ id;
+        if (!_identify(path, id))
+            return nullptr;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto found = _files.find(id);
+        if (found != _files.end())
+        {
+            found->second->refs++;
+            return found->second;
+        }
+
+        _FILE_* file = new _FILE_();
+        if (!file->storage.open(path))
+        {
+            delete file;
+            return nullptr;
+        }
+
+        file->id = id;
+        file->refs = 1;
+        file->size = file->storage.size();
+        _files[id] = file;
+        _stats.files++;
+        return file;
+    }
+
+    void release(HANDLE_T file) {
+
+        if (!file)
+            return;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (--file->refs > 0)
+            return;
+
+        _drop(file);
+        _files.erase(file->id);
+        _stats.files--;
+        delete file;
+    }
+
+    long size(HANDLE_T file) {
+        return file ? file->size : 0;
+    }
+
+    size_t read(HANDLE_T file, long pos, void * out, size_t bytes) {
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        std::vector<char> staging;
+
+        char * dest = (char *)out;
+        long end = (std::min)(pos + long(bytes), file->size);
+
+        // A run of missing blocks is fetched with one transaction, never more than fit in the cap
+        // so the run cannot evict its own first block before it is copied out.
+        while (pos < end)
+        {
+            long index = pos / _block_size;
+            auto found = _blocks.find(_BLOCK_KEY_(file, index));
+
+            if (found == _blocks.end())
+            {
+                if (_loading.count(_BLOCK_KEY_(file, index)))
+                {
+                    _loaded.wait(lock);
+                    continue;
+                }
+
+                long count = 1;
+                while ((index + count) * _block_size < end && size_t(count + 1) * _block_size <= _capacity
+                    && !_blocks.count(_BLOCK_KEY_(file, index + count)) && !_loading.count(_BLOCK_KEY_(file, index + count)))
+                    count++;
+
+                for (long cnt(0); cnt < count; cnt++)
+                    _loading.insert(_BLOCK_KEY_(file, index + cnt));
+                _stats.reads++;
+                long span = _block_end(file, index + count - 1) - index * _block_size;
+
+                lock.unlock();
+                bool fetched = _fetch(file, index, span, staging, _block_size);
+                lock.lock();
+
+                for (long cnt(0); cnt < count; cnt++)
+                    _loading.erase(_BLOCK_KEY_(file, index + cnt));
+                if (fetched)
+                    _publish(file, index, count, staging);
+                _loaded.notify_all();
+
+                if (!fetched)
+                    break;
+                found = _blocks.find(_BLOCK_KEY_(file, index));
+            }
+            else
+                _stats.hits++;
+
+            _lru.splice(_lru.begin(), _lru, found->second);
+
+            long offset = pos - index * _block_size;
+            long count = (std::min)(_block_end(file, index), end) - pos;
+            memcpy(dest, &found->second->data[offset], count);
+            dest += count;
+            pos += count;
+        }
+
+        return dest - (char *)out;
+    }
+
+    OSR_SHARED_CACHE_STATS get_stats() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stats;
+    }
+};
+
+// Reads through OSR_SHARED_BLOCK_CACHE::instance(), one per script.
+class OSR_SHARED_STORAGE : public OSR_STORAGE
+{
+    OSR_SHARED_BLOCK_CACHE::HANDLE_T _file;
+    long _pos;
+
+public:
+
+    OSR_SHARED_STORAGE() : _file(nullptr), _pos(0) {}
+
+    ~OSR_SHARED_STORAGE() {
+        close();
+    }
+
+    bool open(const char * path) override {
+        close();
+        _file = OSR_SHARED_BLOCK_CACHE::instance().acquire(path);
+        _pos = 0;
+        return _file != nullptr;
+    }
+
+    void close() override {
+        OSR_SHARED_BLOCK_CACHE::instance().release(_file);
+        _file = nullptr;
+    }
+
+    long size() override {
+        return OSR_SHARED_BLOCK_CACHE::instance().size(_file);
+    }
+
+    bool seek(long pos) override {
+        _pos = pos;
+        return pos >= 0;
+    }
+
+    size_t read(void * out, size_t bytes) override {
+
+        if (!_file)
+            return 0;
+
+        size_t bytes_read = OSR_SHARED_BLOCK_CACHE::instance().read(_file, _pos, out, bytes);
+        _pos += long(bytes_read);
+        return bytes_read;
+    }
+};
+
+typedef enum _OSR_PREFETCH_POLICY_
+{
+    OSR_PREFETCH_DEMAND,        // reload the window when a frame outside it is needed
+    OSR_PREFETCH_WATERMARK,     // reload right after an emission once few frames are left ahead
+}OSR_PREFETCH_POLICY;
+
+#define OSR_PATH_CAPACITY 260
+
+
+class OSR_SCRIPT
+{
+public:
+
+    typedef enum _SCRIPT_PLAY_STATE_
+    {
+        SCRIPT_STOPPED,
+        SCRIPT_PAUSED,
+        SCRIPT_PLAYING,
+    }SCRIPT_PLAY_STATE;
+
+    // Control requests queued by post() and applied by roll().
+    typedef enum _SCRIPT_COMMAND_TYPE_
+    {
+        SCRIPT_COMMAND_PLAY,
+        SCRIPT_COMMAND_PAUSE,
+        SCRIPT_COMMAND_STOP,
+        SCRIPT_COMMAND_SEEK,            // arg ms of script time
+        SCRIPT_COMMAND_SET_POS,         // arg frame
+        SCRIPT_COMMAND_SET_INTERVAL,    // arg ms per frame
+        SCRIPT_COMMAND_SET_RATE,        // arg / arg2
+        SCRIPT_COMMAND_SET_LATENCY,     // arg ms
+        SCRIPT_COMMAND_SET_LOOP,        // arg 0 or 1
+    }SCRIPT_COMMAND_TYPE;
+
+    struct SCRIPT_COMMAND
+    {
+        SCRIPT_COMMAND_TYPE type;
+        long arg;
+        long arg2;
+    };
+
+    // Playback position as of the last roll(), readable from any thread.
+    struct SCRIPT_STATUS
+    {
+        SCRIPT_PLAY_STATE state;
+        int pos;
+        long time_ms;
+        unsigned long long commands;    // commands applied so far
+    };
+
+private:
+
+    OSR_STORAGE* _storage;          // what reads go through, _source or the block cache in front of it
+    OSR_STORAGE* _source;
+    OSR_FILE_STORAGE _file_storage;
+    OSR_BLOCK_STORAGE* _block_cache;
+    OSR_CLOCK_US _clock;
+    char _path[OSR_PATH_CAPACITY];
+    OSRSB_Header _header;
+    OSRSB_Body * _buffer;
+    
+    int _frame_pos;
+    int _timeline_pos;      // frames since the start of the first pass, equals _frame_pos unless looping
+    int _last_frame_pos;
+    long _start_script_time;        //ms, script time at _start_time
+    long long _start_remainder;     // sub-ms part of the anchor in 1/_rate_den ms
+    unsigned long _start_time;
+    long long _rate_num;            // effective rate, base rate with the sync correction applied
+    long long _rate_den;
+    int _base_rate_num;
+    int _base_rate_den;
+
+    int _sync_ppm;                  // clock slew applied on top of the base rate
+    double _sync_error;             //ms, filtered master minus local position
+    double _sync_integral;
+    unsigned long _sync_last_time;
+
+    int _buffer_length;
+    int _buffer_frames;
+    bool _buffer_locked;
+    bool _buffer_static;            // owned by a subclass, never freed or handed out
+    int _buffer_start_frame_pos;
+
+    int _interval;
+    bool _loop;
+    bool _validation;
+    SCRIPT_PLAY_STATE _state;
+
+    TCODE_OUTPUT_MODE _output_mode;
+    int _dead_band;
+    char _last_emitted[OSRSB_MOTION_UNKNOWN];
+    int _next_key_frame[OSRSB_MOTION_UNKNOWN];
+    long _script_time;              //ms, position being emitted, includes _latency_offset
+    long _latency_offset;           //ms, emit this much ahead of the timebase
+
+    int _output_interval;
+    long _last_output_step;
+    TCODE_INTERP_MODE _interp_mode;
+    OSRSB_Segment _segment[OSRSB_MOTION_UNKNOWN];
+
+    OSR_LATENCY_HISTOGRAM _lateness;
+    std::atomic<unsigned long long> _skipped;
+    OSR_IO_STATS _io_stats;
+
+    OSR_PREFETCH_POLICY _prefetch;
+    int _prefetch_watermark;
+    int _block_align;               // bytes, windows start on a multiple of this in the file
+
+    OSR_SPSC_RING<SCRIPT_COMMAND, 16> _mailbox;
+    unsigned long long _commands;
+    std::atomic<unsigned> _status_seq;      // odd while the status below is being written
+    std::atomic<int> _status_state;
+    std::atomic<int> _status_pos;
+    std::atomic<long> _status_time;
+    std::atomic<unsigned long long> _status_commands;
+
+    unsigned long _now_ms() {
+        return (unsigned long)(_clock() / 1000);
+    };
+
+    bool _seek_file(long pos) {
+        _io_stats.seeks++;
+        return _storage->seek(pos);
+    };
+
+    size_t _read_file(void * out, size_t bytes) {
+
+        unsigned long long begin = _clock();
+        size_t bytes_read = _storage->read(out, bytes);
+        unsigned long long blocked = _clock() - begin;
+
+        _io_stats.reads++;
+        _io_stats.bytes_read += bytes_read;
+        _io_stats.read_us += blocked;
+        if (blocked > _io_stats.max_read_us)
+            _io_stats.max_read_us = blocked;
+
+        return bytes_read;
+    };
+
+
+    bool _parse_script_bin() {
+
+        char message[OSR_PATH_CAPACITY + 48];
+
+        if (!_path[0] || !_storage->open(_path)) {
+            snprintf(message, sizeof(message), "Error opening file: %s", _path);
+            perror(message);
+            return false;
+        }
+
+        size_t bytesRead = _read_file(&_header, sizeof(OSRSB_Header));
+        if (bytesRead != sizeof(OSRSB_Header)) {
+            snprintf(message, sizeof(message), "Error parsing file: %s", _path);
+            perror(message);
+            return false;
+        }
+
+        _interval = _header.interval;
+
+        return long(_header.frame * sizeof(OSRSB_Body) + sizeof(OSRSB_Header)) == _storage->size();
+    };
+
+    int _wrap_frame(long frame) {
+
+        if (!_loop || _header.frame <= 0)
+            return int(frame);
+
+        frame %= _header.frame;
+        return int(frame < 0 ? frame + _header.frame : frame);
+    };
+
+    // In loop mode a window that runs past the last frame continues with the head of the file.
+    void _load_from_script_bin() {
+
+        long file_pos = _buffer_start_frame_pos * sizeof(OSRSB_Body) + sizeof(OSRSB_Header);
+        _io_stats.loads++;
+        _seek_file(file_pos);
+        size_t bytesRead = _read_file(_buffer, _buffer_length * sizeof(OSRSB_Body));
+
+        int tail = _header.frame - _buffer_start_frame_pos;
+        if (_loop && tail > 0 && tail < _buffer_length && bytesRead == tail * sizeof(OSRSB_Body))
+        {
+            int head = _buffer_length - tail < _header.frame - tail ? _buffer_length - tail : _header.frame - tail;
+            _seek_file(sizeof(OSRSB_Header));
+            bytesRead += _read_file(_buffer + tail, head * sizeof(OSRSB_Body));
+        }
+
+        _buffer_frames = int(bytesRead / sizeof(OSRSB_Body));
+        if (bytesRead == 0) {
+            char message[OSR_PATH_CAPACITY + 48];
+            snprintf(message, sizeof(message), "Error reading file: %s at pos: %ld", _path, file_pos);
+            perror(message);
+            memset(_buffer, -1, _buffer_length * sizeof(OSRSB_Body));
+            _buffer_frames = _buffer_length;
+        }
+    };
+
+    int _buffer_index(int frame) {
+
+        int buffer_pos = frame - _buffer_start_frame_pos;
+        if (_loop && buffer_pos < 0)
+            buffer_pos += _header.frame;
+        return buffer_pos;
+    };
+
+    bool _is_resident(int frame) {
+        int buffer_pos = _buffer_index(frame);
+        return buffer_pos >= 0 && buffer_pos < _buffer_frames;
+    };
+
+    // Frames kept behind the playing one so latency calibration can step back without a reload.
+    int _back_margin() {
+        int margin = int((labs(_latency_offset) + _interval - 1) / _interval);
+        return margin < _buffer_length / 4 ? margin : _buffer_length / 4;
+    };
+
+    // Reuses the window when it already holds frame, otherwise reloads it so that frame sits
+    // at the start for forward motion, at the end for backwards playback or in the centre when
+    // scrubbing backwards.
+    void _make_resident(int frame, bool backward = false) {
+
+        if (!_buffer)
+            return;
+
+        if (_is_resident(frame))
+        {
+            _io_stats.hits++;
+            return;
+        }
+
+        _io_stats.misses++;
+        _load_window(frame, backward);
+    };
+
+    void _load_window(int frame, bool backward) {
+
+        int start = frame - _back_margin();
+        if (_reverse())
+            start = frame - _buffer_length + 1 + _back_margin();
+        else if (backward)
+            start = frame - _buffer_length / 2;
+
+        if (_loop)
+            start = _buffer_length >= _header.frame ? 0 : _wrap_frame(start);
+        else
+        {
+            if (start > _header.frame - _buffer_length)
+                start = _header.frame - _buffer_length;
+            if (start > frame)
+                start = frame;
+            if (start < 0)
+                start = 0;
+        }
+
+        _buffer_start_frame_pos = start;
+
+        // Moving back to the block boundary is only worth it while nearly all of the window stays ahead,
+        // and never for the last window, which has to reach the end of the file.
+        if (_block_align > 0 && _reverse())
+            _align_window_end(frame, start);
+        else if (_block_align > 0 && (_loop ? _buffer_length < _header.frame : start + _buffer_length < _header.frame))
+        {
+            long offset = long(start) * sizeof(OSRSB_Body) + sizeof(OSRSB_Header);
+            offset -= offset % _block_align;
+            _buffer_start_frame_pos = offset < long(sizeof(OSRSB_Header)) ? 0 : int((offset - sizeof(OSRSB_Header)) / sizeof(OSRSB_Body));
+            if (_buffer_index(frame) >= _buffer_length / 4)
+                _buffer_start_frame_pos = start;
+        }
+
+        _load_from_script_bin();
+    };
+
+    // Backwards the window is read towards the head of the file, so it is its end that moves
+    // forward to a block boundary, again only while nearly all of it stays ahead.
+    void _align_window_end(int frame, int start) {
+
+        if (_loop ? _buffer_length >= _header.frame : start + _buffer_length >= _header.frame)
+            return;
+
+        long end = long(start + _buffer_length) * sizeof(OSRSB_Body) + sizeof(OSRSB_Header);
+        end += (_block_align - end % _block_align) % _block_align;
+        int aligned = int((end - sizeof(OSRSB_Header)) / sizeof(OSRSB_Body)) - _buffer_length;
+
+        if (!_loop && aligned + _buffer_length > _header.frame)
+            return;
+
+        _buffer_start_frame_pos = _wrap_frame(aligned);
+        if (_buffer_index(frame) < _buffer_length * 3 / 4)
+            _buffer_start_frame_pos = start;
+    };
+
+    // Refills while the frame just sent leaves a whole interval of slack, instead of blocking
+    // the next emission once the window runs out. Backwards the slack is below the frame.
+    void _prefetch_ahead() {
+
+        if (!_buffer || !_is_resident(_frame_pos))
+            return;
+
+        int ahead = _reverse() ? _buffer_index(_frame_pos) : _buffer_frames - _buffer_index(_frame_pos) - 1;
+        if (ahead >= _prefetch_watermark)
+            return;
+        if (_loop ? _buffer_length >= _header.frame
+            : _reverse() ? _buffer_start_frame_pos == 0 : _buffer_start_frame_pos + _buffer_frames >= _header.frame)
+            return;
+
+        _load_window(_frame_pos, false);
+    };
+
+    OSRSB_Body _get_current_motion() {
+
+        _make_resident(_frame_pos);
+
+        return _buffer[_buffer_index(_frame_pos)];
+    };
+
+    // Script time advances by _rate_num/_rate_den ms per wall clock ms, kept exact by carrying the remainder.
+    long _script_time_at(unsigned long now) {
+        long long scaled = (long long)(long)(now - _start_time) * _rate_num + _start_remainder;
+        return _start_script_time + long(scaled / _rate_den);
+    };
+
+    // First wall clock time at which the timebase reaches script_time in the direction of travel.
+    unsigned long _wall_time_at(long script_time) {
+        long long scaled = (long long)(script_time - _start_script_time) * _rate_den - _start_remainder;
+        long long elapsed = scaled / _rate_num;
+        if (scaled % _rate_num != 0 && (scaled > 0) == (_rate_num > 0))
+            elapsed++;
+        return _start_time + (unsigned long)(long)elapsed;
+    };
+
+    bool _reverse() {
+        return _rate_num < 0;
+    };
+
+    // The latency offset leads in the direction of travel, backwards playback emits lower times early.
+    long _lead() {
+        return _reverse() ? -_latency_offset : _latency_offset;
+    };
+
+    // Re-anchors the timebase at the current position before switching to the new ratio. The carried
+    // remainder is truncated to the new denominator, less than 1/den ms lost per change.
+    void _apply_rate(long long num, long long den) {
+
+        long long divisor = std::gcd(num, den);
+        num /= divisor;
+        den /= divisor;
+
+        if (_state == SCRIPT_PLAYING)
+        {
+            unsigned long now = _now_ms();
+            long long scaled = (long long)(long)(now - _start_time) * _rate_num + _start_remainder;
+
+            _start_script_time += long(scaled / _rate_den);
+            _start_remainder = scaled % _rate_den * den / _rate_den;
+            _start_time = now;
+        }
+
+        _rate_num = num;
+        _rate_den = den;
+    };
+
+    void _apply_sync_rate() {
+        _apply_rate((long long)_base_rate_num * (1000000 + _sync_ppm), (long long)_base_rate_den * 1000000);
+    };
+
+    long _wall_span(long script_span) {
+        long long span = (long long)script_span * _rate_den / _rate_num;
+        return long(span < 0 ? -span : span);
+    };
+
+    // Looping backwards moves the timebase up a pass each time it drops below the head of the file,
+    // so frame and step numbers stay positive.
+    void _wrap_backwards() {
+
+        long pass = long(_header.frame) * _interval;
+        if (pass <= 0)
+            return;
+
+        while (_script_time < 0)
+        {
+            _start_script_time += pass;
+            _script_time += pass;
+        }
+
+        if (_last_frame_pos >= 0)
+            _last_frame_pos += _header.frame;
+        _reset_output_state();
+    };
+
+    void _reset_output_state() {
+        memset(_last_emitted, -1, sizeof(_last_emitted));
+        memset(_next_key_frame, -1, sizeof(_next_key_frame));
+        memset(_segment, -1, sizeof(_segment));
+        _last_output_step = -1;
+    };
+
+    // boundary is the script time the frame or step is entered at, its start or, playing backwards,
+    // its last ms. Lateness covers everything between the timebase reaching it and roll() getting there.
+    void _record_emission(long boundary, long skipped, unsigned long long now_us) {
+
+        unsigned long now = (unsigned long)(now_us / 1000);
+        unsigned long scheduled = _wall_time_at(boundary - _lead());
+        if (long(scheduled - _start_time) < 0)
+            scheduled = _start_time;
+
+        long late = long(now - scheduled);
+        _lateness.record(late < 0 ? 0 : (unsigned long long)late * 1000 + now_us % 1000);
+
+        if (skipped > 0)
+            _skipped.fetch_add(skipped, std::memory_order_relaxed);
+    };
+
+    // backward marks a scan towards the head of the file, the window is then reloaded around
+    // the chunk rather than starting at it.
+    int _read_frames(int start, OSRSB_Body * out, int count, bool backward = false) {
+
+        start = _wrap_frame(start);
+        if (start + count > _header.frame)
+            count = _header.frame - start;
+
+        if (start < 0 || count <= 0)
+            return 0;
+
+        // Lookahead drags the window along the way playback does instead of reading around it,
+        // only a run longer than the window goes to the file directly.
+        if (_buffer)
+        {
+            _make_resident(backward || _reverse() ? start + count - 1 : start, backward);
+
+            int buffer_pos = _buffer_index(start);
+            if (buffer_pos >= 0 && buffer_pos + count <= _buffer_frames)
+            {
+                memcpy(out, _buffer + buffer_pos, count * sizeof(OSRSB_Body));
+                return count;
+            }
+        }
+        else
+            _io_stats.misses++;
+
+        _seek_file(start * sizeof(OSRSB_Body) + sizeof(OSRSB_Header));
+        return int(_read_file(out, count * sizeof(OSRSB_Body)) / sizeof(OSRSB_Body));
+    };
+
+    // _read_frames() for readers beside playback, file order only and neither the window nor the
+    // I/O stats move.
+    int _peek_frames(int start, OSRSB_Body * out, int count) {
+
+        if (start + count > _header.frame)
+            count = _header.frame - start;
+
+        if (start < 0 || count <= 0)
+            return 0;
+
+        int buffer_pos = start - _buffer_start_frame_pos;
+        if (_buffer && buffer_pos >= 0 && buffer_pos + count <= _buffer_frames)
+        {
+            memcpy(out, _buffer + buffer_pos, count * sizeof(OSRSB_Body));
+            return count;
+        }
+
+        if (!_storage->seek(start * sizeof(OSRSB_Body) + sizeof(OSRSB_Header)))
+            return 0;
+        return int(_storage->read(out, count * sizeof(OSRSB_Body)) / sizeof(OSRSB_Body));
+    };
+
+    // Frame numbers are on the timeline, in loop mode the search wraps around once.
+    template<OSRSB_MOTION_TYPE A>
+    int _find_next_keyframe(int from, char& out_pos) {
+
+        OSRSB_Body chunk[32];
+        int limit = _loop ? from + _header.frame : _header.frame;
+
+        for (int frame = from; frame < limit;)
+        {
+            int count = _read_frames(frame, chunk, limit - frame < 32 ? limit - frame : 32);
+            if (count <= 0)
+                break;
+
+            for (int cnt(0); cnt < count; cnt++)
+            {
+                char pos = get_motion_value<A>(chunk[cnt]);
+                if (pos != -1)
+                {
+                    out_pos = pos;
+                    return frame + cnt;
+                }
+            }
+
+            frame += count;
+        }
+
+        return -1;
+    };
+
+    template<OSRSB_MOTION_TYPE A>
+    int _find_prev_keyframe(int from, char& out_pos) {
+
+        OSRSB_Body chunk[32];
+        int limit = _loop ? from - _header.frame : -1;
+
+        if (!_loop && from >= _header.frame)
+            from = _header.frame - 1;
+
+        for (int frame = from; frame > limit;)
+        {
+            int start = frame - 31 > limit ? frame - 31 : limit + 1;
+            if (_wrap_frame(start) > _wrap_frame(frame))
+                start = frame - _wrap_frame(frame);     // keep the chunk inside one pass
+            int count = _read_frames(start, chunk, frame - start + 1, true);
+            if (count <= 0)
+                break;
+
+            for (int cnt(count - 1); cnt >= 0; cnt--)
+            {
+                char pos = get_motion_value<A>(chunk[cnt]);
+                if (pos != -1)
+                {
+                    out_pos = pos;
+                    return start + cnt;
+                }
+            }
+
+            frame = start - 1;
+        }
+
+        return -1;
+    };
+
+    // Keeps the keyframe pair around _script_time for one axis, from_frame is -1 before the first keyframe.
+    template<OSRSB_MOTION_TYPE A>
+    OSRSB_Segment& _update_segment() {
+
+        OSRSB_Segment& seg = _segment[A];
+
+        if (seg.to_frame == -1 && seg.from_frame == -1)
+        {
+            seg.from_frame = _find_prev_keyframe<A>(_timeline_pos, seg.from_pos);
+            seg.to_frame = _find_next_keyframe<A>(_timeline_pos + 1, seg.to_pos);
+            if (seg.to_frame < 0)
+                seg.to_frame = INT_MAX;
+        }
+
+        while (seg.to_frame != INT_MAX && _script_time >= long(seg.to_frame) * _interval)
+        {
+            seg.from_frame = seg.to_frame;
+            seg.from_pos = seg.to_pos;
+            seg.to_frame = _find_next_keyframe<A>(seg.from_frame + 1, seg.to_pos);
+            if (seg.to_frame < 0)
+                seg.to_frame = INT_MAX;
+        }
+
+        while (seg.from_frame >= 0 && _script_time < long(seg.from_frame) * _interval)
+        {
+            seg.to_frame = seg.from_frame;
+            seg.to_pos = seg.from_pos;
+            seg.from_frame = _find_prev_keyframe<A>(seg.to_frame - 1, seg.from_pos);
+        }
+
+        return seg;
+    };
+
+    template<OSRSB_MOTION_TYPE A>
+    bool _should_emit(char pos) {
+
+        if (pos == -1)
+            return false;
+
+        if (_output_mode == TCODE_OUTPUT_DELTA && _last_emitted[A] != -1 
+            && abs(pos - _last_emitted[A]) <= _dead_band)
+            return false;
+
+        _last_emitted[A] = pos;
+        return true;
+    };
+
+    template<typename AXES>
+    void _transfer_into_tcode(OSRSB_Body& act, OSR_TCODE_FRAME& tcode) {
+
+        AXES::for_each([&](auto axis) {
+            constexpr auto A = decltype(axis)::value;
+            char pos = get_motion_value<A>(act);
+            if (_should_emit<A>(pos))
+                append_tcode(tcode, get_tcode_axis<A>(), pos);
+        });
+    };
+
+    template<typename AXES>
+    void _transfer_into_resampled_tcode(OSR_TCODE_FRAME& tcode) {
+
+        AXES::for_each([&](auto axis) {
+            constexpr auto A = decltype(axis)::value;
+            OSRSB_Segment& seg = _update_segment<A>();
+            if (seg.from_frame < 0)
+                return;
+
+            char pos = seg.from_pos;
+            if (seg.to_frame != INT_MAX)
+            {
+                long from_time = long(seg.from_frame) * _interval;
+                long span = long(seg.to_frame - seg.from_frame) * _interval;
+                pos = interpolate_motion(seg.from_pos, seg.to_pos, _script_time - from_time, span, _interp_mode);
+            }
+
+            if (_should_emit<A>(pos))
+                append_tcode(tcode, get_tcode_axis<A>(), pos);
+        });
+    };
+
+    // Once an axis reaches its pending keyframe, send the next one with the time left to reach it.
+    // Playing backwards the next one is the previous keyframe in the file.
+    template<typename AXES>
+    void _transfer_into_interval_tcode(OSR_TCODE_FRAME& tcode) {
+
+        OSRSB_Body act;
+        bool current = false;
+
+        AXES::for_each([&](auto axis) {
+            constexpr auto A = decltype(axis)::value;
+            int pending = _next_key_frame[A];
+            if (pending == INT_MAX || (pending >= 0 && (_reverse() ? _timeline_pos > pending : _timeline_pos < pending)))
+                return;
+
+            if (pending < 0 && !current)
+                current = _read_frames(_timeline_pos, &act, 1) == 1;
+
+            // Starting on a keyframe sends the device there first, the move to the next one goes out
+            // right behind it.
+            char pos = current && pending < 0 ? get_motion_value<A>(act) : -1;
+            if (pos != -1)
+            {
+                _last_emitted[A] = pos;
+                append_tcode(tcode, get_tcode_axis<A>(), pos);
+            }
+
+            int next = _reverse() ? _find_prev_keyframe<A>(_timeline_pos - 1, pos) : _find_next_keyframe<A>(_timeline_pos + 1, pos);
+            if (next < 0)
+            {
+                _next_key_frame[A] = INT_MAX;
+                return;
+            }
+
+            // Backwards a keyframe is reached as its frame is entered, at the last ms of it.
+            long arrival = _reverse() ? long(next + 1) * _interval - 1 : long(next) * _interval;
+            _next_key_frame[A] = next;
+            _last_emitted[A] = pos;
+            append_tcode(tcode, get_tcode_axis<A>(), pos, int(_wall_span(arrival - _script_time)));
+        });
+    };
+
+    // Backwards the next frame or step is entered once the timebase drops below the start of the current one.
+    template<typename AXES>
+    unsigned long _get_prev_deadline_ms() {
+
+        long next;
+        if (_output_mode == TCODE_OUTPUT_INTERVAL)
+        {
+            int frame = -1;
+            AXES::for_each([&](auto axis) {
+                constexpr auto A = decltype(axis)::value;
+                int pending = _next_key_frame[A] < 0 ? _timeline_pos : _next_key_frame[A];
+                if (pending != INT_MAX && pending > frame)
+                    frame = pending;
+            });
+            next = long(frame + 1) * _interval - 1;
+        }
+        else
+        {
+            long step = _output_interval > 0 ? _output_interval : _interval;
+            next = _script_time / step * step - 1;
+        }
+
+        if (next > _script_time)
+            next = _script_time;
+
+        return _wall_time_at(next - _lead());
+    };
+
+    // Runs on the roll() thread, so the setters below never race the playback state.
+    bool _apply_commands() {
+
+        SCRIPT_COMMAND command;
+        bool applied = false;
+
+        while (_mailbox.pop(command))
+        {
+            switch (command.type)
+            {
+            case SCRIPT_COMMAND_PLAY        : play(); break;
+            case SCRIPT_COMMAND_PAUSE       : pause(); break;
+            case SCRIPT_COMMAND_STOP        : stop(); break;
+            case SCRIPT_COMMAND_SEEK        : seek_ms(command.arg); break;
+            case SCRIPT_COMMAND_SET_POS     : set_pos(int(command.arg)); break;
+            case SCRIPT_COMMAND_SET_INTERVAL: set_interval(int(command.arg)); break;
+            case SCRIPT_COMMAND_SET_RATE    : set_rate(int(command.arg), int(command.arg2)); break;
+            case SCRIPT_COMMAND_SET_LATENCY : set_latency_offset(command.arg); break;
+            case SCRIPT_COMMAND_SET_LOOP    : set_loop(command.arg != 0); break;
+            }
+
+            _commands++;
+            applied = true;
+        }
+
+        return applied;
+    };
+
+    // Seqlock writer, readers retry instead of ever making roll() wait.
+    void _publish_status() {
+
+        unsigned seq = _status_seq.load(std::memory_order_relaxed);
+        _status_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        _status_state.store(_state, std::memory_order_relaxed);
+        _status_pos.store(_frame_pos, std::memory_order_relaxed);
+        _status_time.store(get_time_ms(), std::memory_order_relaxed);
+        _status_commands.store(_commands, std::memory_order_relaxed);
+
+        _status_seq.store(seq + 2, std::memory_order_release);
+    };
+
+protected:
+
+    // For subclasses that keep the frame window inline, it must hold get_buffer_length() frames.
+    void _use_static_buffer(OSRSB_Body * buffer) {
+        _buffer = buffer;
+        _buffer_frames = 0;
+        _buffer_static = true;
+    };
+
+public:
+
+    // storage is not owned, without one the file is read with stdio.
+    OSR_SCRIPT(const char * path, int buffer_length = 128, OSR_STORAGE* storage = nullptr) {
+
+        // Paths that do not fit are rejected rather than opening a truncated one.
+        _path[0] = 0;
+        if (strlen(path) < sizeof(_path))
+            strcpy(_path, path);
+        _source = storage ? storage : &_file_storage;
+        _storage = _source;
+        _block_cache = nullptr;
+        _clock = get_curr_time_us;
+        _frame_pos = 0;
+        _timeline_pos = 0;
+        _buffer = nullptr;
+        _start_script_time = 0;
+        _start_remainder = 0;
+        _start_time = 0;
+        _rate_num = 1;
+        _rate_den = 1;
+        _base_rate_num = 1;
+        _base_rate_den = 1;
+        _sync_ppm = 0;
+        _sync_error = 0;
+        _sync_integral = 0;
+        _sync_last_time = 0;
+        _last_frame_pos = -1;
+        _state = SCRIPT_STOPPED;
+        _buffer_length = buffer_length;
+        _buffer_frames = 0;
+        _buffer_locked = false;
+        _buffer_static = false;
+        _buffer_start_frame_pos = 0;
+        _output_mode = TCODE_OUTPUT_FULL;
+        _dead_band = 0;
+        _script_time = 0;
+        _latency_offset = 0;
+        _output_interval = 0;
+        _interp_mode = TCODE_INTERP_LINEAR;
+        _loop = false;
+        _skipped = 0;
+        memset(&_io_stats, 0, sizeof(_io_stats));
+        _prefetch = OSR_PREFETCH_DEMAND;
+        _prefetch_watermark = 0;
+        _block_align = 0;
+        _commands = 0;
+        _status_seq = 0;
+        _status_state = SCRIPT_STOPPED;
+        _status_pos = 0;
+        _status_time = 0;
+        _status_commands = 0;
+        _reset_output_state();
+
+        _validation = _parse_script_bin();
+
+    }
+
+    OSR_SCRIPT(const String& path, int buffer_length = 128, OSR_STORAGE* storage = nullptr)
+        : OSR_SCRIPT(path.c_str(), buffer_length, storage) {}
+
+    virtual ~OSR_SCRIPT() {
+
+        unlock_memory();
+
+        if(_buffer && !_buffer_static)
+            free_buffer(_buffer);
+        _buffer = nullptr;
+
+        _storage->close();
+        delete _block_cache;
+    }
+
+    void rewind(){
+        set_pos(0);
+    }
+
+    void set_pos(int pos) {
+        seek_frame(pos);
+    };
+
+    void seek_frame(int frame) {
+        seek_ms(long(frame) * _interval);
+    };
+
+    // Moves playback to script time ms, keeping the timebase anchored so a running script
+    // continues from there instead of adding the time already elapsed.
+    void seek_ms(long ms) {
+
+        if (!_validation)
+            return;
+
+        long end = long(_header.frame) * _interval - 1;
+        if (_loop && end > 0)
+            ms = (ms % (end + 1) + end + 1) % (end + 1);
+        if (ms > end)
+            ms = end;
+        if (ms < 0)
+            ms = 0;
+
+        int frame = int(ms / _interval);
+        bool backward = frame < _frame_pos;
+
+        _frame_pos = frame;
+        _timeline_pos = frame;
+        _last_frame_pos = -1;
+        _start_script_time = ms;
+        _start_remainder = 0;
+        _start_time = _now_ms();
+        _sync_last_time = 0;
+        _script_time = ms + _lead();
+        _reset_output_state();
+        _make_resident(_script_time > 0 ? _wrap_frame(_script_time / _interval) : 0, backward);
+    };
+
+    long get_time_ms() {
+        return _script_time - _lead();
+    };
+
+    int get_pos() {
+        return _frame_pos;
+    };
+
+    // Allocates the buffer, or takes over a recycled one of get_buffer_length() frames, and fills
+    // the first window so that play() does not have to touch the file. On false a recycled buffer
+    // was not taken and still belongs to the caller.
+    bool prepare(OSRSB_Body * buffer = nullptr) {
+
+        if (!_validation || (_buffer && buffer))
+            return false;
+
+        if (buffer)
+        {
+            _buffer = buffer;
+            _buffer_frames = 0;
+        }
+
+        if (!_buffer)
+        {
+            _buffer = alloc_buffer(_buffer_length);
+            _buffer_frames = 0;
+        }
+
+        _make_resident(_frame_pos);
+        return true;
+    }
+
+    // Hands the buffer back for reuse by another script, the next play() allocates a new one.
+    OSRSB_Body * release_buffer() {
+
+        if (_buffer_static)
+            return nullptr;
+
+        unlock_memory();
+
+        OSRSB_Body * buffer = _buffer;
+        _buffer = nullptr;
+        _buffer_frames = 0;
+        return buffer;
+    }
+
+    int get_buffer_length() {
+        return _buffer_length;
+    }
+
+    // Frame buffers start on a page and fill whole pages, so locking one never pins or unpins
+    // memory of its neighbours. Buffers from release_buffer() go back through free_buffer().
+    static size_t get_buffer_bytes(int length) {
+        size_t page = get_page_size();
+        return (length * sizeof(OSRSB_Body) + page - 1) / page * page;
+    }
+
+    static OSRSB_Body * alloc_buffer(int length) {
+        void * pages = alloc_pages(get_buffer_bytes(length));
+        if (!pages)
+            throw std::bad_alloc();
+        return (OSRSB_Body *)pages;
+    }
+
+    static void free_buffer(OSRSB_Body * buffer) {
+        free_pages(buffer);
+    }
+
+    // Pins the frame buffer in RAM and touches every page so playback never takes a page fault on it.
+    // An inline buffer shares its pages with the object around it, it is touched but not pinned.
+    bool lock_memory() {
+
+        if (!prepare())
+            return false;
+
+        if (_buffer_locked)
+            return true;
+
+        size_t bytes = _buffer_static ? _buffer_length * sizeof(OSRSB_Body) : get_buffer_bytes(_buffer_length);
+        if (!_buffer_static)
+        {
+#ifdef _WIN32
+            _buffer_locked = VirtualLock(_buffer, bytes) != 0;
+#else
+            _buffer_locked = mlock(_buffer, bytes) == 0;
+#endif
+        }
+
+        // The last byte too, an inline buffer may end part way into a page the stride skips.
+        volatile char * first = (volatile char *)_buffer;
+        for (size_t offset(0); offset < bytes; offset += get_page_size())
+            first[offset] = first[offset];
+        first[bytes - 1] = first[bytes - 1];
+
+        return _buffer_locked;
+    }
+
+    void unlock_memory() {
+
+        if (!_buffer_locked)
+            return;
+
+#ifdef _WIN32
+        VirtualUnlock(_buffer, get_buffer_bytes(_buffer_length));
+#else
+        munlock(_buffer, get_buffer_bytes(_buffer_length));
+#endif
+        _buffer_locked = false;
+    }
+
+    void play(){
+        play_at(_now_ms());
+    }
+
+    // Starts with the timebase anchored at start_time, so a script can pick up exactly where
+    // the previous one ended.
+    void play_at(unsigned long start_time){
+
+        prepare();
+
+        _state = SCRIPT_PLAYING;
+        _timeline_pos = _frame_pos;
+        _start_script_time = long(_frame_pos) * _interval;
+        _start_remainder = 0;
+        _start_time = start_time;
+        _script_time = long(_frame_pos) * _interval + _lead();
+        _reset_output_state();
+    }
+
+    // Wall clock time at which the last frame of the current pass ends if playback is not interrupted,
+    // playing backwards the pass ends with its first frame.
+    unsigned long get_end_time_ms() {
+        if (_header.frame <= 0)
+            return _start_time;
+
+        if (_reverse())
+            return _wall_time_at(long(_timeline_pos / _header.frame) * _header.frame * _interval - 1 - _lead());
+
+        long end = (long(_timeline_pos / _header.frame) + 1) * _header.frame;
+        return _wall_time_at(end * _interval - _lead());
+    }
+
+    // Loop mode plays the file endlessly, the buffer window wraps across the end so the seam
+    // needs neither a reload nor a timebase reset.
+    void set_loop(bool loop) {
+
+        if (loop == _loop)
+            return;
+
+        long ms = get_time_ms();
+        if (_loop && _header.frame > 0)
+            ms %= long(_header.frame) * _interval;
+
+        _loop = loop;
+
+        bool playing = _state == SCRIPT_PLAYING;
+        seek_ms(ms);
+        if (playing)
+            _state = SCRIPT_PLAYING;
+    }
+
+    bool get_loop() {
+        return _loop;
+    }
+
+    bool is_playing() {
+        return _state == SCRIPT_PLAYING;
+    }
+
+    void pause() {
+        _state = SCRIPT_PAUSED;
+    }
+
+    void stop() {
+        rewind();
+        _start_time = 0;
+        _state = SCRIPT_STOPPED;
+    }
+
+    bool vaildate() {
+        return _validation;
+    }
+
+    SCRIPT_PLAY_STATE roll(String& out_tcode){
+
+        OSR_TCODE_FRAME frame;
+        frame.length = -1;
+
+        SCRIPT_PLAY_STATE state = roll(frame);
+        if (frame.length >= 0)
+            out_tcode.assign(frame.tcode, frame.length);
+
+        return state;
+    };
+
+    // Heap-free roll(), out_tcode is left untouched unless the script is playing. AXES picks the
+    // axes decoded and sent, see OSR_PLAYER.
+    template<typename AXES = OSR_AXES_DEFAULT>
+    SCRIPT_PLAY_STATE roll(OSR_TCODE_FRAME& out_tcode){
+        return _roll_at<AXES>(out_tcode, _now_ms(), true);
+    };
+
+    // roll() as if the clock read now, e.g. a deadline from get_next_deadline_ms() to render
+    // ahead of time. now must not go backwards. Frames rendered ahead are not counted in
+    // get_timing_stats(), they were never late.
+    template<typename AXES = OSR_AXES_DEFAULT>
+    SCRIPT_PLAY_STATE roll_at(OSR_TCODE_FRAME& out_tcode, unsigned long now){
+        return _roll_at<AXES>(out_tcode, now, false);
+    };
+
+private:
+
+    // timed records how late each frame went out against the clock.
+    template<typename AXES>
+    SCRIPT_PLAY_STATE _roll_at(OSR_TCODE_FRAME& out_tcode, unsigned long now, bool timed){
+
+        if(!_validation)
+        {
+            out_tcode.length = snprintf(out_tcode.tcode, OSR_TCODE_CAPACITY, "Invaild Script.");
+            return SCRIPT_STOPPED;
+        }
+
+        SCRIPT_PLAY_STATE state = _state;
+        bool changed = _apply_commands();
+
+        if (_state == SCRIPT_PLAYING)
+        {
+            long boundary = -1;
+            long skipped = 0;
+
+            out_tcode.timestamp = now;
+            out_tcode.length = 0;
+            out_tcode.tcode[0] = 0;
+
+            _script_time = _script_time_at(out_tcode.timestamp) + _lead();
+            if (_script_time < 0 && _loop && _reverse())
+                _wrap_backwards();
+
+            _timeline_pos = int(_script_time / _interval);
+            _frame_pos = _wrap_frame(_timeline_pos);
+
+            if (_script_time >= 0 && !_loop && _frame_pos >= _header.frame)
+                stop();
+            else if (_script_time < 0 && _reverse())
+                stop();
+            else if (_script_time >= 0)
+            {
+                if (_output_interval > 0 && _output_mode != TCODE_OUTPUT_INTERVAL)
+                {
+                    long step = _script_time / _output_interval;
+                    if (step != _last_output_step)
+                    {
+                        boundary = _reverse() ? (step + 1) * _output_interval - 1 : step * _output_interval;
+                        skipped = _last_output_step < 0 ? 0 : labs(step - _last_output_step) - 1;
+                        _last_output_step = step;
+                        _transfer_into_resampled_tcode<AXES>(out_tcode);
+                    }
+                }
+                else if (_last_frame_pos != _timeline_pos)
+                {
+                    // Interval output only wakes up for keyframes, the frames in between are not due.
+                    boundary = _reverse() ? long(_timeline_pos + 1) * _interval - 1 : long(_timeline_pos) * _interval;
+                    skipped = _last_frame_pos < 0 || _output_mode == TCODE_OUTPUT_INTERVAL ? 0 : abs(_timeline_pos - _last_frame_pos) - 1;
+                    _last_frame_pos = _timeline_pos;
+                    if (_output_mode == TCODE_OUTPUT_INTERVAL)
+                        _transfer_into_interval_tcode<AXES>(out_tcode);
+                    else
+                    {
+                        OSRSB_Body act = _get_current_motion();
+                        _transfer_into_tcode<AXES>(act, out_tcode);
+                    }
+                }
+            }
+
+            // Timed after the transfer so a refill that held the frame up counts as lateness.
+            if (boundary >= 0)
+            {
+                if (timed)
+                    _record_emission(boundary, skipped, _clock());
+                if (_prefetch == OSR_PREFETCH_WATERMARK)
+                    _prefetch_ahead();
+                changed = true;
+            }
+        }
+
+        if (changed || state != _state)
+            _publish_status();
+
+        return _state;
+    };
+
+public:
+
+#if defined(__cpp_impl_coroutine)
+
+    // Frames from..to-1 in file order, read a block at a time when the generator gets there, e.g.
+    // for analysis or offline filters. Frames already in the window are copied out, the rest come
+    // straight from storage, so the window and the I/O stats stay as playback left them.
+    OSR_GENERATOR<OSR_FRAME_ITEM> frames(int from = 0, int to = INT_MAX) {
+
+        OSRSB_Body chunk[64];
+
+        if (!_validation)
+            co_return;
+        if (to > _header.frame)
+            to = _header.frame;
+
+        for (int frame = from < 0 ? 0 : from; frame < to;)
+        {
+            int count = _peek_frames(frame, chunk, to - frame < 64 ? to - frame : 64);
+            if (count <= 0)
+                break;
+
+            for (int cnt(0); cnt < count; cnt++)
+                co_yield OSR_FRAME_ITEM{ long(frame + cnt) * _interval, &chunk[cnt] };
+
+            frame += count;
+        }
+    };
+
+    // Plays the script, yielding each non-empty tcode with the deadline it is due at. Nothing
+    // waits, the frames are rendered at their deadlines ahead of the clock, so a realtime consumer
+    // sleeps until item.deadline before sending while an offline one just writes the items out.
+    // Ends when the script stops or is paused. Rendered ahead, so get_timing_stats() is left alone.
+    template<typename AXES = OSR_AXES_DEFAULT>
+    OSR_GENERATOR<OSR_TCODE_ITEM> tcode_items() {
+
+        OSR_TCODE_FRAME frame;
+
+        if (!is_playing())
+            play();
+
+        for (unsigned long deadline = _now_ms(); roll_at<AXES>(frame, deadline) == SCRIPT_PLAYING;)
+        {
+            if (frame.length > 0)
+                co_yield OSR_TCODE_ITEM{ deadline, std::string_view(frame.tcode, frame.length) };
+
+            // A deadline that was already due must not hold the timeline in place.
+            unsigned long next = get_next_deadline_ms<AXES>();
+            deadline = long(next - deadline) > 0 ? next : deadline + 1;
+        }
+    };
+
+#endif
+
+    // Thread-safe control, e.g. from a UI thread while another one calls roll(). The command is
+    // queued without locking and applied by the next roll(), between two frames. One thread may
+    // post, false means the mailbox is full.
+    bool post(SCRIPT_COMMAND_TYPE type, long arg = 0, long arg2 = 1) {
+
+        SCRIPT_COMMAND command = { type, arg, arg2 };
+        return _mailbox.push(command);
+    }
+
+    // Consistent snapshot from any thread, lags the script by at most one roll().
+    SCRIPT_STATUS get_status() const {
+
+        SCRIPT_STATUS status;
+        unsigned seq;
+
+        do
+        {
+            seq = _status_seq.load(std::memory_order_acquire);
+            status.state = SCRIPT_PLAY_STATE(_status_state.load(std::memory_order_relaxed));
+            status.pos = _status_pos.load(std::memory_order_relaxed);
+            status.time_ms = _status_time.load(std::memory_order_relaxed);
+            status.commands = _status_commands.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((seq & 1) || seq != _status_seq.load(std::memory_order_relaxed));
+
+        return status;
+    }
+
+    // Every time read by the script goes through clock, e.g. a simulated one for benchmarks.
+    void set_clock(OSR_CLOCK_US clock) {
+        _clock = clock ? clock : get_curr_time_us;
+    }
+
+    // watermark is the number of frames ahead of the playing one below which the window is
+    // refilled, 0 picks a quarter of the buffer.
+    void set_prefetch(OSR_PREFETCH_POLICY policy, int watermark = 0) {
+        _prefetch = policy;
+        _prefetch_watermark = watermark > 0 && watermark < _buffer_length / 2 ? watermark : _buffer_length / 4;
+    }
+
+    OSR_PREFETCH_POLICY get_prefetch() {
+        return _prefetch;
+    }
+
+    // Keeps the last blocks read in memory, so scrubbing back and forth over recently visited
+    // regions reloads the window without touching the file. 0 blocks removes the cache.
+    void set_block_cache(int blocks, int block_size = 4096) {
+
+        delete _block_cache;
+        _block_cache = nullptr;
+        _storage = _source;
+
+        if (blocks > 0 && block_size > 0)
+        {
+            _block_cache = new OSR_BLOCK_STORAGE(_source, block_size, blocks);
+            _storage = _block_cache;
+        }
+    }
+
+    OSR_BLOCK_STATS get_block_cache_stats() const {
+
+        OSR_BLOCK_STATS stats;
+        memset(&stats, 0, sizeof(stats));
+        return _block_cache ? _block_cache->get_stats() : stats;
+    }
+
+    // Starts buffer windows on block_size boundaries of the file, e.g. the 512 byte sectors of an
+    // SD card read through OSR_BLOCK_STORAGE. 0 turns it off, the size must be a multiple of 8.
+    bool set_block_alignment(int block_size) {
+
+        if (block_size < 0 || block_size % sizeof(OSRSB_Body))
+            return false;
+
+        _block_align = block_size;
+        return true;
+    }
+
+    void set_interval(int v) {
+        if (v > 0 && v < 100000)
+        {
+            _interval = v;
+            play();
+        }
+    }
+
+    int get_interval() {
+        return _interval;
+    }
+
+    // Resamples the keyframes every ms milliseconds regardless of the file interval, 0 follows the file.
+    void set_output_interval(int ms, TCODE_INTERP_MODE mode = TCODE_INTERP_LINEAR) {
+        if (ms >= 0 && ms < 100000)
+        {
+            _output_interval = ms;
+            _interp_mode = mode;
+            _reset_output_state();
+        }
+    }
+
+    int get_output_interval() {
+        return _output_interval;
+    }
+
+    // Wall clock time at which roll() next has something to emit, for callers that schedule it.
+    // AXES must match the ones passed to roll().
+    template<typename AXES = OSR_AXES_DEFAULT>
+    unsigned long get_next_deadline_ms() {
+
+        if (_reverse())
+            return _get_prev_deadline_ms<AXES>();
+
+        long next;
+        if (_output_mode == TCODE_OUTPUT_INTERVAL)
+        {
+            int frame = INT_MAX;
+            AXES::for_each([&](auto axis) {
+                constexpr auto A = decltype(axis)::value;
+                if (_next_key_frame[A] < frame)
+                    frame = _next_key_frame[A] < 0 ? _timeline_pos : _next_key_frame[A];
+            });
+            // No keyframe left on any axis, looping only the end of the pass is worth waking up for.
+            if (frame == INT_MAX)
+                frame = _loop && _header.frame > 0 ? (_timeline_pos / _header.frame + 1) * _header.frame : _header.frame;
+            else if (!_loop && frame > _header.frame)
+                frame = _header.frame;
+            next = long(frame) * _interval;
+        }
+        else
+        {
+            long step = get_roll_interval();
+            next = (_script_time / step + 1) * step;
+        }
+
+        if (next < _script_time)
+            next = _script_time;
+
+        return _wall_time_at(next - _lead());
+    }
+
+    // How often roll() has something new to say, in wall clock ms.
+    int get_roll_interval() {
+        long step = _wall_span(_output_interval > 0 && _output_mode != TCODE_OUTPUT_INTERVAL ? _output_interval : _interval);
+        return step > 0 ? int(step) : 1;
+    }
+
+    // Between 1/16 and 16 times real time in either direction.
+    static bool is_valid_rate(int num, int den) {
+        return num != 0 && den > 0 && abs(num) <= den * 16 && den <= abs(num) * 16;
+    }
+
+    // Plays num/den script ms per wall clock ms, a negative num plays backwards. The timebase is
+    // re-anchored at the current position, so changing the rate never moves playback.
+    bool set_rate(int num, int den = 1) {
+
+        if (!is_valid_rate(num, den))
+            return false;
+
+        long ms = get_time_ms();
+
+        _base_rate_num = num;
+        _base_rate_den = den;
+        _apply_sync_rate();
+
+        // Turning around moves the latency lead to the other side of the timebase.
+        _script_time = ms + _lead();
+
+        // Pending interval moves were timed for the old rate.
+        memset(_next_key_frame, -1, sizeof(_next_key_frame));
+        return true;
+    }
+
+    double get_rate() {
+        return double(_base_rate_num) / _base_rate_den;
+    }
+
+    // Feeds one reading of an external master clock, e.g. the video player position, taken now.
+    // Small errors are slewed away by a PI controller on the rate, only large ones seek.
+    void sync_to_master(long master_ms, long max_error = 1000) {
+
+        if (_state != SCRIPT_PLAYING)
+            return;
+
+        unsigned long now = _now_ms();
+        double error = double(master_ms - _script_time_at(now));
+
+        if (fabs(error) > max_error)
+        {
+            seek_ms(master_ms);
+            _sync_ppm = 0;
+            _sync_error = 0;
+            _sync_integral = 0;
+            _sync_last_time = now;
+            _apply_sync_rate();
+            return;
+        }
+
+        double dt = _sync_last_time ? double(long(now - _sync_last_time)) : 0;
+        _sync_last_time = now;
+
+        // Readings carry IPC jitter, the filter keeps it from modulating the rate.
+        _sync_error += (error - _sync_error) / 4;
+        _sync_integral += _sync_error * dt;
+
+        // Proportional part removes an offset within ~4 s, integral part cancels steady drift.
+        double ppm = _sync_error * 250 + _sync_integral / 32;
+        if (ppm > 50000) ppm = 50000;
+        if (ppm < -50000) ppm = -50000;
+
+        _sync_ppm = int(ppm);
+        _apply_sync_rate();
+    }
+
+    int get_sync_ppm() {
+        return _sync_ppm;
+    }
+
+    // Devices act 50-150 ms after a command arrives, a positive offset emits every frame that much
+    // early. Safe to call while playing, e.g. to calibrate a device by ear.
+    void set_latency_offset(long ms) {
+
+        if (ms <= -10000 || ms >= 10000)
+            return;
+
+        long time = get_time_ms();
+        _latency_offset = ms;
+        _script_time = time + _lead();
+        _reset_output_state();
+    }
+
+    void adjust_latency_offset(long delta) {
+        set_latency_offset(_latency_offset + delta);
+    }
+
+    long get_latency_offset() {
+        return _latency_offset;
+    }
+
+    // Interval mode sends each axis once per keyframe with an I suffix so the device interpolates.
+    // Delta mode only sends an axis when it moved more than dead_band since its last emission.
+    void set_output_mode(TCODE_OUTPUT_MODE mode, int dead_band = 0) {
+        _output_mode = mode;
+        _dead_band = dead_band < 0 ? 0 : dead_band;
+        _reset_output_state();
+    }
+
+    TCODE_OUTPUT_MODE get_output_mode() {
+        return _output_mode;
+    }
+
+    String inline get_file_path() const {
+        return String(_path);
+    }
+
+    // Safe to call from another thread while roll() runs.
+    const OSR_LATENCY_HISTOGRAM& get_lateness_histogram() const {
+        return _lateness;
+    }
+
+    OSR_TIMING_STATS get_timing_stats() const {
+
+        OSR_TIMING_STATS stats;
+        stats.frames = _lateness.count();
+        stats.skipped = _skipped.load(std::memory_order_relaxed);
+        stats.p50 = _lateness.percentile(0.5);
+        stats.p99 = _lateness.percentile(0.99);
+        stats.p999 = _lateness.percentile(0.999);
+        stats.max = _lateness.max();
+        return stats;
+    }
+
+    void reset_timing_stats() {
+        _lateness.reset();
+        _skipped.store(0, std::memory_order_relaxed);
+    }
+
+    // Reader counters, read them from the thread that calls roll().
+    OSR_IO_STATS get_io_stats() const {
+        return _io_stats;
+    }
+
+    void reset_io_stats() {
+        memset(&_io_stats, 0, sizeof(_io_stats));
+    }
+};
+
+
+// Heap-free OSR_SCRIPT for MCU builds, the N frame window is inline so sizeof() is the whole
+// RAM cost and shows up at link time. Paths and output use fixed buffers, roll() into an
+// OSR_TCODE_FRAME to keep playback off the heap as well.
+template<int N>
+class OSR_SCRIPT_STATIC : public OSR_SCRIPT
+{
+    static_assert(N > 0, "OSR_SCRIPT_STATIC needs at least one frame");
+
+    std::array<OSRSB_Body, N> _frames;
+
+public:
+
+    OSR_SCRIPT_STATIC(const char * path, OSR_STORAGE* storage = nullptr) : OSR_SCRIPT(path, N, storage) {
+        _use_static_buffer(_frames.data());
+    }
+};
+
+// Plays scripts back to back. The next script is opened, validated and its first window filled
+// on a worker thread while the current one plays, buffers of finished scripts are reused.
+class OSR_PLAYLIST
+{
+    std::vector<String> _paths;
+    size_t _index;
+    int _buffer_length;
+    unsigned long _preload_lead;    //ms before the end of the current script
+    std::function<void(OSR_SCRIPT&)> _configure;
+    std::function<void(OSR_SCRIPT&)> _on_finished;
+    std::function<void(OSR_SCRIPT&)> _on_skipped;
+
+    OSR_SCRIPT * _current;
+    std::future<OSR_SCRIPT*> _next;
+    std::vector<OSRSB_Body*> _free_buffers;
+
+    OSRSB_Body * _take_buffer() {
+
+        if (_free_buffers.empty())
+            return nullptr;
+
+        OSRSB_Body * buffer = _free_buffers.back();
+        _free_buffers.pop_back();
+        return buffer;
+    }
+
+    void _recycle(OSR_SCRIPT * script) {
+
+        OSRSB_Body * buffer = script->release_buffer();
+        if (buffer)
+            _free_buffers.push_back(buffer);
+        delete script;
+    }
+
+    OSR_SCRIPT * _load(const String& path, OSRSB_Body * buffer) {
+
+        OSR_SCRIPT * script = new OSR_SCRIPT(path, _buffer_length);
+        if (_configure)
+            _configure(*script);
+
+        if (!script->prepare(buffer))
+            OSR_SCRIPT::free_buffer(buffer);
+        return script;
+    }
+
+    void _preload() {
+
+        if (_next.valid() || _index + 1 >= _paths.size())
+            return;
+
+        // The worker gets its own copy of the path, add() may grow _paths while it runs.
+        String path = _paths[_index + 1];
+        OSRSB_Body * buffer = _take_buffer();
+        _next = std::async(std::launch::async, [this, path, buffer]() {
+            return _load(path, buffer);
+        });
+    }
+
+    // Switches at the boundary, start_time is where the finished script ended.
+    bool _advance(unsigned long start_time) {
+
+        while (_index + 1 < _paths.size())
+        {
+            OSR_SCRIPT * next = _next.valid() ? _next.get() : _load(_paths[_index + 1], _take_buffer());
+            _index++;
+
+            if (_current && _current->vaildate() && _on_finished)
+                _on_finished(*_current);
+            if (_current)
+                _recycle(_current);
+            _current = next;
+
+            if (_current->vaildate())
+            {
+                _current->play_at(start_time);
+                return true;
+            }
+
+            if (_on_skipped)
+                _on_skipped(*_current);
+        }
+
+        return false;
+    }
+
+public:
+
+    OSR_PLAYLIST(int buffer_length = 128, unsigned long preload_lead = 2000) {
+        _index = 0;
+        _current = nullptr;
+        _buffer_length = buffer_length;
+        _preload_lead = preload_lead;
+    }
+
+    ~OSR_PLAYLIST() {
+
+        if (_next.valid())
+            _recycle(_next.get());
+        if (_current)
+            _recycle(_current);
+
+        for (OSRSB_Body * buffer : _free_buffers)
+            OSR_SCRIPT::free_buffer(buffer);
+    }
+
+    void add(String path) {
+        _paths.push_back(path);
+    }
+
+    // Applied to every script once it is opened, e.g. to set the output mode.
+    void set_configure(std::function<void(OSR_SCRIPT&)> configure) {
+        _configure = configure;
+    }
+
+    // Called with every script that played to its end before it is recycled, e.g. to read its stats.
+    void set_on_finished(std::function<void(OSR_SCRIPT&)> on_finished) {
+        _on_finished = on_finished;
+    }
+
+    // Called with every script that could not be opened, the playlist moves on to the next one.
+    void set_on_skipped(std::function<void(OSR_SCRIPT&)> on_skipped) {
+        _on_skipped = on_skipped;
+    }
+
+    bool play() {
+
+        if (_current)
+        {
+            _current->play();
+            return true;
+        }
+
+        if (_paths.empty())
+            return false;
+
+        _current = _load(_paths[0], nullptr);
+        _index = 0;
+        if (_current->vaildate())
+        {
+            _current->play();
+            return true;
+        }
+
+        if (_on_skipped)
+            _on_skipped(*_current);
+        return _advance(get_curr_time_ms());
+    }
+
+    void pause() {
+        if (_current)
+            _current->pause();
+    }
+
+    OSR_SCRIPT::SCRIPT_PLAY_STATE roll(String& out_tcode) {
+
+        out_tcode = String("");
+
+        if (!_current || !_current->is_playing())
+            return OSR_SCRIPT::SCRIPT_STOPPED;
+
+        unsigned long now = get_curr_time_ms();
+        unsigned long end = _current->get_end_time_ms();
+
+        if (long(end - now) <= long(_preload_lead))
+            _preload();
+
+        // Switch before the current script reaches its end, roll() would stop and rewind it.
+        if (long(now - end) >= 0)
+            _advance(end);
+
+        OSR_SCRIPT::SCRIPT_PLAY_STATE state = _current->roll(out_tcode);
+        if (state == OSR_SCRIPT::SCRIPT_STOPPED && _on_finished)
+            _on_finished(*_current);
+
+        return state;
+    }
+
+    OSR_SCRIPT * get_current() {
+        return _current;
+    }
+
+    size_t get_index() {
+        return _index;
+    }
+};
+
+
+class OSR_SINK
+{
+public:
+    virtual ~OSR_SINK() {}
+    virtual void write(const String& tcode) = 0;
+
+    // Retries output held back by a full port, true once nothing is left.
+    virtual bool flush() {
+        return true;
+    }
+};
+
+class OSR_STREAM_SINK : public OSR_SINK
+{
+    std::ostream& _stream;
+    String _name;
+
+    // Shared by every stream sink, several usually write to std::cout.
+    static std::mutex& _stream_mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+public:
+    OSR_STREAM_SINK(std::ostream& stream, String name) : _stream(stream), _name(name) {}
+
+    // The line is formatted first and written in one go, so sinks on other threads never tear it.
+    void write(const String& tcode) override {
+
+        String line = "[" + _name + "] " + tcode + "\n";
+
+        std::lock_guard<std::mutex> lock(_stream_mutex());
+        _stream.write(line.data(), line.size());
+        _stream.flush();
+    }
+};
+
+// Sinks for OSR_PLAYER take a whole frame through a plain write(const OSR_TCODE_FRAME&).
+
+// One line per frame through stdio, no heap. On a device stdout is usually the UART.
+class OSR_FILE_SINK
+{
+    FILE* _file;
+
+public:
+    OSR_FILE_SINK(FILE* file) : _file(file) {}
+
+    void write(const OSR_TCODE_FRAME& frame) {
+        fwrite(frame.tcode, 1, frame.length, _file);
+        fputc('\n', _file);
+    }
+};
+
+// Lets OSR_PLAYER drive any of the OSR_SINK implementations.
+class OSR_DYNAMIC_SINK
+{
+    OSR_SINK& _sink;
+
+public:
+    OSR_DYNAMIC_SINK(OSR_SINK& sink) : _sink(sink) {}
+
+    void write(const OSR_TCODE_FRAME& frame) {
+        _sink.write(String(frame.tcode, frame.length));
+    }
+};
+
+// Single device player with the axis set and the sink fixed at compile time. Only the listed
+// axes are decoded and formatted, in an unrolled loop, and the write is a direct call, so a
+// stroke-only OSR_PLAYER<OSR_AXES_STROKE, UART> carries no code for the other axes.
+template<typename AXES, typename SINK>
+class OSR_PLAYER
+{
+    OSR_SCRIPT& _script;
+    SINK& _sink;
+    OSR_TCODE_FRAME _frame;
+
+public:
+
+    OSR_PLAYER(OSR_SCRIPT& script, SINK& sink) : _script(script), _sink(sink) {
+        _frame.length = 0;
+    }
+
+    OSR_SCRIPT::SCRIPT_PLAY_STATE poll() {
+
+        OSR_SCRIPT::SCRIPT_PLAY_STATE state = _script.roll<AXES>(_frame);
+        if (state == OSR_SCRIPT::SCRIPT_PLAYING && _frame.length > 0)
+            _sink.write(_frame);
+
+        return state;
+    }
+
+    unsigned long get_next_deadline_ms() {
+        return _script.get_next_deadline_ms<AXES>();
+    }
+
+    // Plays to the end, sleeping until each deadline. While paused it keeps polling for commands
+    // posted from another thread.
+    void run() {
+
+        if (!_script.is_playing())
+            _script.play();
+
+        for (OSR_SCRIPT::SCRIPT_PLAY_STATE state; (state = poll()) != OSR_SCRIPT::SCRIPT_STOPPED;)
+        {
+            long wait = state == OSR_SCRIPT::SCRIPT_PAUSED ? 10 : long(get_next_deadline_ms() - get_curr_time_ms());
+            if (wait > 0)
+                Sleep(wait);
+        }
+    }
+};
+
+
+typedef enum _OSR_OVERFLOW_POLICY_
+{
+    OSR_OVERFLOW_DROP,      // never stall the producer, count and drop the frame
+    OSR_OVERFLOW_BLOCK,     // wait for the consumer, count how often that happened
+}OSR_OVERFLOW_POLICY;
+
+struct OSR_PIPE_STATS
+{
+    unsigned long long produced;
+    unsigned long long written;
+    unsigned long long overflow;        // frames dropped on a full ring
+    unsigned long long backpressure;    // pushes that had to wait for room
+    unsigned long long truncated;       // frames longer than OSR_TCODE_CAPACITY
+    unsigned long max_queue_delay;      //ms between production and the sink write
+};
+
+class OSR_ASYNC_SINK;
+
+// The one thread that writes out the frames queued by every OSR_ASYNC_SINK, it sleeps until a
+// sink has work instead of polling.
+class OSR_ASYNC_CONSUMER
+{
+    std::vector<OSR_ASYNC_SINK*> _sinks;
+    std::mutex _mutex;                  // guards _sinks, held while they are drained
+    std::mutex _wait_mutex;
+    std::condition_variable _wake;
+    std::atomic<unsigned long long> _signal;    // bumped on every push
+    std::atomic<bool> _waiting;
+    std::atomic<bool> _running;
+    std::thread _thread;
+
+    void _run();
+
+    OSR_ASYNC_CONSUMER() : _signal(0), _waiting(false), _running(false) {}
+
+public:
+
+    static OSR_ASYNC_CONSUMER& instance() {
+        static OSR_ASYNC_CONSUMER consumer;
+        return consumer;
+    }
+
+    ~OSR_ASYNC_CONSUMER() {
+
+        {
+            std::lock_guard<std::mutex> lock(_wait_mutex);
+            _running = false;
+        }
+        _wake.notify_all();
+
+        if (_thread.joinable())
+            _thread.join();
+    }
+
+    void attach(OSR_ASYNC_SINK* sink) {
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _sinks.push_back(sink);
+
+        if (!_running)
+        {
+            _running = true;
+            _thread = std::thread([this]() { _run(); });
+        }
+    }
+
+    // Once this returns the consumer no longer touches sink.
+    void detach(OSR_ASYNC_SINK* sink) {
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _sinks.erase(std::remove(_sinks.begin(), _sinks.end(), sink), _sinks.end());
+    }
+
+    // Producers only take the lock while the consumer is actually asleep.
+    void notify() {
+
+        _signal.fetch_add(1);
+        if (_waiting.load())
+        {
+            std::lock_guard<std::mutex> lock(_wait_mutex);
+            _wake.notify_one();
+        }
+    }
+};
+
+// Decouples frame computation from a slow sink: write() only enqueues, OSR_ASYNC_CONSUMER does the I/O.
+class OSR_ASYNC_SINK : public OSR_SINK
+{
+    OSR_SINK* _target;
+    OSR_OVERFLOW_POLICY _policy;
+    OSR_SPSC_RING<OSR_TCODE_FRAME, 256> _ring;
+
+    std::atomic<unsigned long long> _produced;
+    std::atomic<unsigned long long> _written;
+    std::atomic<unsigned long long> _overflow;
+    std::atomic<unsigned long long> _backpressure;
+    std::atomic<unsigned long long> _truncated;
+    std::atomic<unsigned long> _max_queue_delay;
+
+public:
+
+    OSR_ASYNC_SINK(OSR_SINK* target, OSR_OVERFLOW_POLICY policy = OSR_OVERFLOW_DROP) 
+        : _target(target), _policy(policy),
+        _produced(0), _written(0), _overflow(0), _backpressure(0), _truncated(0), _max_queue_delay(0) {
+
+        OSR_ASYNC_CONSUMER::instance().attach(this);
+    }
+
+    // Drains whatever is still queued before returning.
+    ~OSR_ASYNC_SINK() {
+        OSR_ASYNC_CONSUMER::instance().detach(this);
+        drain();
+    }
+
+    // Writes out every queued frame, called by the consumer thread, returns the number written.
+    int drain() {
+
+        OSR_TCODE_FRAME frame;
+        String tcode;
+        int count = 0;
+
+        while (_ring.pop(frame))
+        {
+            tcode.assign(frame.tcode, frame.length);
+            _target->write(tcode);
+            _written.fetch_add(1, std::memory_order_relaxed);
+            count++;
+
+            unsigned long delay = get_curr_time_ms() - frame.timestamp;
+            if (delay > _max_queue_delay.load(std::memory_order_relaxed))
+                _max_queue_delay.store(delay, std::memory_order_relaxed);
+        }
+
+        return count;
+    }
+
+    void write(const String& tcode) override {
+
+        OSR_TCODE_FRAME frame;
+        frame.timestamp = get_curr_time_ms();
+        frame.length = (int)tcode.size();
+        if (frame.length > OSR_TCODE_CAPACITY)
+        {
+            frame.length = OSR_TCODE_CAPACITY;
+            _truncated.fetch_add(1, std::memory_order_relaxed);
+        }
+        memcpy(frame.tcode, tcode.data(), frame.length);
+
+        _produced.fetch_add(1, std::memory_order_relaxed);
+
+        if (!_ring.push(frame))
+        {
+            if (_policy == OSR_OVERFLOW_DROP)
+            {
+                _overflow.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            _backpressure.fetch_add(1, std::memory_order_relaxed);
+            while (!_ring.push(frame))
+                std::this_thread::yield();
+        }
+
+        OSR_ASYNC_CONSUMER::instance().notify();
+    }
+
+    OSR_SINK* get_target() {
+        return _target;
+    }
+
+    OSR_PIPE_STATS get_stats() {
+
+        OSR_PIPE_STATS stats;
+        stats.produced = _produced.load();
+        stats.written = _written.load();
+        stats.overflow = _overflow.load();
+        stats.backpressure = _backpressure.load();
+        stats.truncated = _truncated.load();
+        stats.max_queue_delay = _max_queue_delay.load();
+        return stats;
+    }
+};
+
+inline void OSR_ASYNC_CONSUMER::_run() {
+
+    while (_running)
+    {
+        unsigned long long seen = _signal.load();
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (OSR_ASYNC_SINK* sink : _sinks)
+                sink->drain();
+        }
+
+        // A push after seen was read either shows up in the predicate or finds _waiting set.
+        std::unique_lock<std::mutex> lock(_wait_mutex);
+        _waiting = true;
+        _wake.wait(lock, [&]() { return _signal.load() != seen || !_running; });
+        _waiting = false;
+    }
+}
+
+
+struct OSR_SERIAL_STATS
+{
+    unsigned long long frames;          // frames handed to write()
+    unsigned long long lines;           // lines that went on the wire
+    unsigned long long bytes;
+    unsigned long long coalesced;       // frames merged into a line that was still waiting
+    unsigned long long would_block;     // writes cut short because the port was full
+};
+
+// Writes one newline terminated TCode line per frame to a tty without ever blocking. While the
+// port is busy the next line is held back and later frames are merged into it axis by axis.
+class OSR_SERIAL_SINK : public OSR_SINK
+{
+    enum { LINE_TIMES = 1024 };
+
+    int _fd;
+    String _device;
+    String _inflight;   // rest of a line the port accepted partially, must go out first
+    String _queued;     // next line, still open for merging
+    unsigned long long _queued_time;
+    unsigned long long _line_times[LINE_TIMES];
+    OSR_SERIAL_STATS _stats;
+    std::mutex _mutex;  // line times and stats are read from other threads
+
+    static String _to_line(const String& tcode) {
+
+        String line(tcode);
+        while (!line.empty() && line.back() == ' ')
+            line.pop_back();
+        line += '\n';
+        return line;
+    }
+
+    // Later commands supersede earlier ones for the same axis, other axes are kept.
+    static String _merge_line(const String& older, const String& newer) {
+
+        String merged;
+        size_t pos = 0;
+
+        while (pos < older.size())
+        {
+            size_t end = older.find_first_of(" \n", pos);
+            if (end == String::npos)
+                end = older.size();
+
+            String token = older.substr(pos, end - pos);
+            if (token.size() >= 2 && newer.find(token.substr(0, 2)) == String::npos)
+                merged += token + " ";
+
+            pos = end + 1;
+        }
+
+        return merged + newer;
+    }
+
+    bool _write_some(String& data) {
+#ifdef _WIN32
+        return false;
+#else
+        while (!data.empty())
+        {
+            ssize_t done = ::write(_fd, data.data(), data.size());
+            if (done < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    _stats.would_block++;
+                else
+                    perror((String("Error writing to: ") + _device).c_str());
+                return false;
+            }
+
+            _stats.bytes += done;
+            data.erase(0, done);
+        }
+        return true;
+#endif
+    }
+
+    // Pushes out as much as the port takes right now, returns true when nothing is left.
+    bool _flush() {
+
+        if (!_inflight.empty() && !_write_some(_inflight))
+            return false;
+
+        if (_queued.empty())
+            return true;
+
+        _line_times[_stats.lines % LINE_TIMES] = _queued_time;
+        _stats.lines++;
+        _inflight.swap(_queued);
+        _queued.clear();
+
+        return _write_some(_inflight);
+    }
+
+public:
+
+    OSR_SERIAL_SINK() : _fd(-1), _queued_time(0) {
+        memset(&_stats, 0, sizeof(_stats));
+        memset(_line_times, 0, sizeof(_line_times));
+    }
+
+    ~OSR_SERIAL_SINK() {
+        close();
+    }
+
+    bool open(const String& device, int baud = 115200) {
+
+        close();
+        _device = device;
+
+#ifdef _WIN32
+        std::cerr << "Serial output is not supported on this platform: " << device << std::endl;
+        return false;
+#else
+        _fd = ::open(device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (_fd < 0) {
+            perror((String("Error opening serial port: ") + device).c_str());
+            return false;
+        }
+
+        speed_t speed;
+        switch (baud)
+        {
+        case 9600  : speed = B9600; break;
+        case 19200 : speed = B19200; break;
+        case 38400 : speed = B38400; break;
+        case 57600 : speed = B57600; break;
+        case 115200: speed = B115200; break;
+        case 230400: speed = B230400; break;
+        default:
+            std::cerr << "Unsupported baud rate: " << baud << std::endl;
+            close();
+            return false;
+        }
+
+        termios tio;
+        if (tcgetattr(_fd, &tio) == 0)
+        {
+            cfmakeraw(&tio);
+            cfsetispeed(&tio, speed);
+            cfsetospeed(&tio, speed);
+            tio.c_cflag |= CLOCAL | CREAD;
+            tcsetattr(_fd, TCSANOW, &tio);
+        }
+
+        return true;
+#endif
+    }
+
+    void close() {
+#ifndef _WIN32
+        if (_fd >= 0)
+            ::close(_fd);
+#endif
+        _fd = -1;
+        _inflight.clear();
+        _queued.clear();
+    }
+
+    bool is_open() {
+        return _fd >= 0;
+    }
+
+    void write(const String& tcode) override {
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_fd < 0)
+            return;
+
+        _stats.frames++;
+
+        if (_queued.empty())
+        {
+            _queued = _to_line(tcode);
+            _queued_time = get_curr_time_us();
+        }
+        else
+        {
+            _queued = _merge_line(_queued, _to_line(tcode));
+            _stats.coalesced++;
+        }
+
+        _flush();
+    }
+
+    bool flush() override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _flush();
+    }
+
+    // When the n-th line on the wire was first handed to write(), in get_curr_time_us() units.
+    unsigned long long get_line_time(unsigned long long line) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return line < _stats.lines && _stats.lines - line <= LINE_TIMES ? _line_times[line % LINE_TIMES] : 0;
+    }
+
+    OSR_SERIAL_STATS get_stats() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stats;
+    }
+};
+
+
+// Reads the playback position of an mpv instance started with --input-ipc-server=<path>,
+// anything answering get_property the same way on a UNIX socket works as a master clock.
+class OSR_MPV_CLOCK
+{
+    int _fd;
+    int _request_id;
+    String _pending;
+
+public:
+
+    OSR_MPV_CLOCK() : _fd(-1), _request_id(0) {}
+
+    ~OSR_MPV_CLOCK() {
+        close();
+    }
+
+    bool open(const String& path) {
+
+        close();
+
+#ifdef _WIN32
+        std::cerr << "mpv IPC sync is not supported on this platform: " << path << std::endl;
+        return false;
+#else
+        _fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (_fd < 0) {
+            perror("Error creating socket");
+            return false;
+        }
+
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+        if (connect(_fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            perror((String("Error connecting to: ") + path).c_str());
+            close();
+            return false;
+        }
+
+        return true;
+#endif
+    }
+
+    void close() {
+#ifndef _WIN32
+        if (_fd >= 0)
+            ::close(_fd);
+#endif
+        _fd = -1;
+        _pending.clear();
+    }
+
+    // Master position in ms, compensated by half the round trip. Waits at most timeout_ms.
+    bool query(long& out_ms, int timeout_ms = 50) {
+
+#ifdef _WIN32
+        return false;
+#else
+        if (_fd < 0)
+            return false;
+
+        int id = ++_request_id;
+        String request = String("{\"command\":[\"get_property\",\"playback-time\"],\"request_id\":") + to_string(id) + "}\n";
+
+        unsigned long sent = get_curr_time_ms();
+        if (::write(_fd, request.data(), request.size()) != (ssize_t)request.size())
+            return false;
+
+        while (long(get_curr_time_ms() - sent) < timeout_ms)
+        {
+            size_t end;
+            while ((end = _pending.find('\n')) != String::npos)
+            {
+                String reply = _pending.substr(0, end);
+                _pending.erase(0, end + 1);
+
+                // mpv also pushes unsolicited events on the same socket.
+                size_t field = reply.find("\"request_id\"");
+                size_t colon = field == String::npos ? field : reply.find(':', field);
+                if (colon == String::npos || atoi(reply.c_str() + colon + 1) != id)
+                    continue;
+
+                field = reply.find("\"data\"");
+                colon = field == String::npos ? field : reply.find(':', field);
+                if (colon == String::npos)
+                    return false;
+
+                char* stop = nullptr;
+                double seconds = strtod(reply.c_str() + colon + 1, &stop);
+                if (stop == reply.c_str() + colon + 1)
+                    return false;
+
+                out_ms = long(seconds * 1000) + long(get_curr_time_ms() - sent) / 2;
+                return true;
+            }
+
+            pollfd pfd = { _fd, POLLIN, 0 };
+            if (poll(&pfd, 1, timeout_ms) <= 0)
+                return false;
+
+            char data[512];
+            ssize_t count = ::read(_fd, data, sizeof(data));
+            if (count <= 0)
+                return false;
+            _pending.append(data, count);
+        }
+
+        return false;
+#endif
+    }
+};
+
+
+struct OSR_TIMER
+{
+    OSR_TIMER* next;
+    OSR_TIMER* prev;
+    unsigned long expires;  //ms
+    void* owner;
+};
+
+// Hierarchical timer wheel with 1 ms ticks: 4 levels of 64 slots cover 2^24 ms,
+// insertion and removal are O(1) and every timer cascades at most 3 times.
+class OSR_TIMER_WHEEL
+{
+    enum { LEVELS = 4, SLOT_BITS = 6, SLOTS = 1 << SLOT_BITS, SLOT_MASK = SLOTS - 1 };
+
+    OSR_TIMER _slots[LEVELS][SLOTS];
+    unsigned long _current;
+    int _count;
+
+    static void _link(OSR_TIMER* head, OSR_TIMER* timer) {
+        timer->prev = head->prev;
+        timer->next = head;
+        head->prev->next = timer;
+        head->prev = timer;
+    }
+
+    static void _unlink(OSR_TIMER* timer) {
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        timer->next = timer->prev = nullptr;
+    }
+
+    void _place(OSR_TIMER* timer) {
+
+        unsigned long delta = timer->expires - _current;
+        if ((long)delta < 0)
+        {
+            timer->expires = _current;
+            delta = 0;
+        }
+
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (1UL << (SLOT_BITS * (level + 1))))
+            level++;
+
+        if (delta >= (1UL << (SLOT_BITS * LEVELS)))
+            timer->expires = _current + (1UL << (SLOT_BITS * LEVELS)) - 1;
+
+        _link(&_slots[level][(timer->expires >> (SLOT_BITS * level)) & SLOT_MASK], timer);
+    }
+
+    void _cascade(int level) {
+
+        OSR_TIMER* head = &_slots[level][(_current >> (SLOT_BITS * level)) & SLOT_MASK];
+        while (head->next != head)
+        {
+            OSR_TIMER* timer = head->next;
+            _unlink(timer);
+            _place(timer);
+        }
+    }
+
+public:
+
+    OSR_TIMER_WHEEL(unsigned long now = 0) {
+
+        _current = now;
+        _count = 0;
+
+        for (int level(0); level < LEVELS; level++)
+            for (int slot(0); slot < SLOTS; slot++)
+                _slots[level][slot].next = _slots[level][slot].prev = &_slots[level][slot];
+    }
+
+    void add(OSR_TIMER* timer, unsigned long expires) {
+        timer->expires = expires;
+        _place(timer);
+        _count++;
+    }
+
+    void remove(OSR_TIMER* timer) {
+        if (timer->next)
+        {
+            _unlink(timer);
+            _count--;
+        }
+    }
+
+    int size() {
+        return _count;
+    }
+
+    // Earliest time a timer may fire, for sleeping until then. Timers on the upper levels report
+    // the start of their slot, which is never later than their expiry. False when empty.
+    bool next_expiry(unsigned long& expires) {
+
+        bool found = false;
+
+        for (int level(0); level < LEVELS && _count > 0; level++)
+        {
+            int shift = SLOT_BITS * level;
+            for (int step(0); step < SLOTS; step++)
+            {
+                unsigned long tick = (_current >> shift) + step;
+                OSR_TIMER* head = &_slots[level][tick & SLOT_MASK];
+                if (head->next == head)
+                    continue;
+
+                // Past its first tick the current slot of an upper level was cascaded already,
+                // what it holds is a rotation ahead, so keep looking for a nearer one.
+                bool ahead = level > 0 && step == 0 && (_current & ((1UL << shift) - 1));
+
+                unsigned long at = (ahead ? tick + SLOTS : tick) << shift;
+                if (!found || (long)(at - expires) < 0)
+                    expires = at;
+                found = true;
+                if (!ahead)
+                    break;
+            }
+        }
+
+        return found;
+    }
+
+    // Advances the wheel to now and hands every expired timer to on_expire, which may re-add it.
+    template<typename F>
+    void advance(unsigned long now, F on_expire) {
+
+        while ((long)(now - _current) >= 0)
+        {
+            for (int level(1); level < LEVELS; level++)
+            {
+                if ((_current >> (SLOT_BITS * (level - 1))) & SLOT_MASK)
+                    break;
+                _cascade(level);
+            }
+
+            OSR_TIMER* head = &_slots[0][_current & SLOT_MASK];
+            while (head->next != head)
+            {
+                OSR_TIMER* timer = head->next;
+                _unlink(timer);
+                _count--;
+                on_expire(timer);
+            }
+
+            _current++;
+        }
+    }
+};
+
+
+struct OSR_REALTIME_REPORT
+{
+    bool requested;
+    bool affinity;          // thread pinned to the requested CPU
+    bool fifo;              // SCHED_FIFO granted
+    bool stack;             // stack pre-faulted and locked
+    int locked_buffers;
+    int failed_buffers;
+};
+
+static inline void print_realtime_report(const OSR_REALTIME_REPORT& report)
+{
+    if (!report.requested)
+        return;
+
+    std::cerr << "realtime  affinity: " << (report.affinity ? "granted" : "denied")
+        << "  SCHED_FIFO: " << (report.fifo ? "granted" : "denied")
+        << "  stack: " << (report.stack ? "locked" : "unlocked")
+        << "  buffers locked: " << report.locked_buffers << "/" << report.locked_buffers + report.failed_buffers << std::endl;
+}
+
+static inline void print_timing_stats(const String& name, const OSR_TIMING_STATS& stats)
+{
+    std::cerr << name << " frames: " << stats.frames << "  skipped: " << stats.skipped
+        << "  lateness p50: " << stats.p50 << "us  p99: " << stats.p99 << "us  p99.9: " << stats.p999
+        << "us  max: " << stats.max << "us" << std::endl;
+}
+
+static inline void print_io_stats(const String& name, const OSR_IO_STATS& stats)
+{
+    std::cerr << name << " buffer hits: " << stats.hits << "  misses: " << stats.misses << "  loads: " << stats.loads
+        << "  reads: " << stats.reads << "  bytes: " << stats.bytes_read << "  seeks: " << stats.seeks
+        << "  blocked: " << stats.read_us << "us  max read: " << stats.max_read_us << "us" << std::endl;
+}
+
+// Opt-in real-time setup for the calling thread, every step is best effort and reported.
+// SCHED_FIFO and mlock usually need CAP_SYS_NICE / CAP_IPC_LOCK or matching rlimits.
+static inline void enable_realtime(int cpu, int priority, OSR_REALTIME_REPORT& report)
+{
+    memset(&report, 0, sizeof(report));
+    report.requested = true;
+
+#ifdef __linux__
+    if (cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        report.affinity = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+
+    sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    report.fifo = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+
+    volatile char stack[64 * 1024];
+    for (size_t offset(0); offset < sizeof(stack); offset += 4096)
+        stack[offset] = 0;
+    report.stack = mlock((const void*)stack, sizeof(stack)) == 0;
+#else
+    (void)cpu;
+    (void)priority;
+#endif
+}
+
+
+// Plays any number of scripts from one thread, each wakes up only at its own next deadline.
+class OSR_PLAYBACK_ENGINE
+{
+    struct _TRACK_
+    {
+        OSR_TIMER timer;
+        OSR_TIMER retry;        // armed while the sink holds back output
+        OSR_SCRIPT* script;
+        OSR_SINK* sink;
+    };
+
+    OSR_TIMER_WHEEL _wheel;
+    std::vector<_TRACK_*> _tracks;
+    std::vector<_TRACK_*> _pending;
+    std::vector<OSR_SCRIPT*> _removed;
+    std::mutex _mutex;
+    std::condition_variable _wake;          // signalled by add(), remove() and stop()
+    std::thread _thread;
+    std::atomic<bool> _running;
+    String _tcode;
+
+    int _rt_cpu;
+    int _rt_priority;
+    OSR_REALTIME_REPORT _rt_report;
+
+    void _lock_memory(_TRACK_* track) {
+
+        if (!_rt_report.requested)
+            return;
+
+        if (track->script->lock_memory())
+            _rt_report.locked_buffers++;
+        else
+            _rt_report.failed_buffers++;
+    }
+
+    void _roll(_TRACK_* track) {
+
+        OSR_SCRIPT::SCRIPT_PLAY_STATE state = track->script->roll(_tcode);
+        if (state == OSR_SCRIPT::SCRIPT_STOPPED)
+            return;
+
+        // Paused scripts stay on the wheel so that a play posted from another thread is picked up.
+        if (state == OSR_SCRIPT::SCRIPT_PAUSED)
+        {
+            _wheel.add(&track->timer, get_curr_time_ms() + 10);
+            return;
+        }
+
+        if (!_tcode.empty())
+        {
+            track->sink->write(_tcode);
+            _flush(track);
+        }
+
+        _wheel.add(&track->timer, track->script->get_next_deadline_ms());
+    }
+
+    // A line the port did not take whole is retried every tick instead of waiting for the next
+    // write, which in interval mode can be a whole stroke away.
+    void _flush(_TRACK_* track) {
+
+        if (!track->retry.next && !track->sink->flush())
+            _wheel.add(&track->retry, get_curr_time_ms() + 1);
+    }
+
+    void _expire(OSR_TIMER* timer) {
+
+        _TRACK_* track = (_TRACK_*)timer->owner;
+        if (timer == &track->retry)
+            _flush(track);
+        else
+            _roll(track);
+    }
+
+    void _admit() {
+
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        for (OSR_SCRIPT* script : _removed)
+            for (size_t cnt(0); cnt < _tracks.size(); cnt++)
+                if (_tracks[cnt]->script == script)
+                {
+                    _wheel.remove(&_tracks[cnt]->timer);
+                    _wheel.remove(&_tracks[cnt]->retry);
+                    delete _tracks[cnt];
+                    _tracks.erase(_tracks.begin() + cnt);
+                    break;
+                }
+        _removed.clear();
+
+        for (_TRACK_* track : _pending)
+        {
+            _tracks.push_back(track);
+            _lock_memory(track);
+            _roll(track);
+        }
+        _pending.clear();
+    }
+
+    // Sleeps until the wheel's next expiry, or until add(), remove() or stop() has something new.
+    void _run() {
+
+        if (_rt_report.requested)
+        {
+            enable_realtime(_rt_cpu, _rt_priority, _rt_report);
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (_TRACK_* track : _tracks)
+                _lock_memory(track);
+        }
+
+        while (_running)
+        {
+            if (poll() == 0 && idle())
+                break;
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            unsigned long expires;
+            long wait = _wheel.next_expiry(expires) ? long(expires - get_curr_time_ms()) : 1000;
+            if (_running && _pending.empty() && _removed.empty() && wait > 0)
+                _wake.wait_for(lock, std::chrono::milliseconds(wait));
+        }
+    }
+
+public:
+
+    OSR_PLAYBACK_ENGINE() : _wheel(get_curr_time_ms()), _running(false), _rt_cpu(-1), _rt_priority(0) {
+        memset(&_rt_report, 0, sizeof(_rt_report));
+    }
+
+    // Applied by run() to the thread that schedules, cpu -1 leaves the affinity alone.
+    void set_realtime(int cpu, int priority = 80) {
+        _rt_cpu = cpu;
+        _rt_priority = priority;
+        _rt_report.requested = true;
+    }
+
+    OSR_REALTIME_REPORT get_realtime_report() {
+        return _rt_report;
+    }
+
+    ~OSR_PLAYBACK_ENGINE() {
+
+        stop();
+
+        for (_TRACK_* track : _tracks)
+            delete track;
+        for (_TRACK_* track : _pending)
+            delete track;
+    }
+
+    // The script is started right away, the engine does not take ownership of script or sink.
+    bool add(OSR_SCRIPT* script, OSR_SINK* sink) {
+
+        if (!script->vaildate())
+            return false;
+
+        _TRACK_* track = new _TRACK_();
+        track->script = script;
+        track->sink = sink;
+        track->timer.owner = track;
+        track->retry.owner = track;
+
+        script->play();
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _pending.push_back(track);
+        }
+        _wake.notify_all();
+        return true;
+    }
+
+    // Takes a script off the engine at its next pass, script and sink are let go of by the time
+    // stop() or join() returns at the latest.
+    void remove(OSR_SCRIPT* script) {
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            bool pending = false;
+            for (size_t cnt(0); cnt < _pending.size() && !pending; cnt++)
+                if (_pending[cnt]->script == script)
+                {
+                    delete _pending[cnt];
+                    _pending.erase(_pending.begin() + cnt);
+                    pending = true;
+                }
+
+            if (!pending)
+                _removed.push_back(script);
+        }
+        _wake.notify_all();
+    }
+
+    // Runs one scheduling pass, returns the number of scripts still playing or sinks still flushing.
+    int poll() {
+
+        _admit();
+        _wheel.advance(get_curr_time_ms(), [this](OSR_TIMER* timer) {
+            _expire(timer);
+        });
+
+        return _wheel.size();
+    }
+
+    bool idle() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _pending.empty() && _wheel.size() == 0;
+    }
+
+    // Returns once every script has stopped or stop() was called.
+    void run() {
+        _running = true;
+        _run();
+        _running = false;
+    }
+
+    // Marked running before the thread exists, so a stop() right after start() always wins.
+    void start() {
+        stop();
+        _running = true;
+        _thread = std::thread([this]() { _run(); });
+    }
+
+    void stop() {
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _running = false;
+        }
+        _wake.notify_all();
+
+        if (_thread.joinable())
+            _thread.join();
+    }
+
+    void join() {
+        if (_thread.joinable())
+            _thread.join();
+    }
+};
+
+
+template<typename AXES>
+static int run_axis_player(OSR_SCRIPT& script)
+{
+    OSR_FILE_SINK sink(stdout);
+    OSR_PLAYER<AXES, OSR_FILE_SINK> player(script, sink);
+    player.run();
+    fflush(stdout);
+    return 0;
+}
+
+static unsigned long long osr_sim_time_us = 0;
+
+static unsigned long long get_sim_time_us() {
+    return osr_sim_time_us;
+}
+
+// Plays one pass of the script per buffer length and prefetch policy against an emulated SD
+// card. Time is simulated: reads advance the clock by their modelled cost and roll() is called
+// at every deadline, so a sweep takes milliseconds and two runs give the same numbers.
+static int run_storage_benchmark(const String& path, std::function<void(OSR_SCRIPT&)> configure)
+{
+    static const int lengths[] = { 16, 32, 64, 128, 256, 512, 1024 };
+    static const OSR_PREFETCH_POLICY policies[] = { OSR_PREFETCH_DEMAND, OSR_PREFETCH_WATERMARK };
+
+    printf("%7s %-9s %-6s %7s %7s %8s %8s %8s %6s %8s %8s %6s %9s\n", "buffer", "prefetch", "reader", "frames", "skipped",
+        "p50 us", "p99 us", "max us", "loads", "requests", "sectors", "stalls", "busy ms");
+
+    for (int length : lengths)
+    for (OSR_PREFETCH_POLICY policy : policies)
+    for (int aligned(0); aligned < 2; aligned++)
+    {
+        OSR_FILE_STORAGE file;
+        OSR_SD_PROFILE profile = get_default_sd_profile();
+        OSR_SD_STORAGE sd(&file, profile, &osr_sim_time_us);
+        OSR_BLOCK_STORAGE blocks(&sd, profile.sector_size);
+        osr_sim_time_us = 0;
+
+        OSR_SCRIPT script(path, length, aligned ? (OSR_STORAGE*)&blocks : &sd);
+        if (!script.vaildate())
+        {
+            std::cout << "Script file: " << path << " is not available." << std::endl;
+            return -1;
+        }
+
+        configure(script);
+        script.set_clock(get_sim_time_us);
+        script.set_prefetch(policy);
+        if (aligned)
+            script.set_block_alignment(profile.sector_size);
+        script.play();
+
+        String tcode;
+        unsigned long end = script.get_end_time_ms();
+        while (script.roll(tcode) && long(osr_sim_time_us / 1000 - end) < 0)
+        {
+            unsigned long long deadline = (unsigned long long)script.get_next_deadline_ms() * 1000;
+            if (deadline > osr_sim_time_us)
+                osr_sim_time_us = deadline;
+        }
+
+        OSR_TIMING_STATS timing = script.get_timing_stats();
+        OSR_IO_STATS io = script.get_io_stats();
+        OSR_SD_STATS card = sd.get_stats();
+        printf("%7d %-9s %-6s %7llu %7llu %8llu %8llu %8llu %6llu %8llu %8llu %6llu %9llu\n", length,
+            policy == OSR_PREFETCH_DEMAND ? "demand" : "watermark", aligned ? "block" : "plain", timing.frames, timing.skipped,
+            timing.p50, timing.p99, timing.max, io.loads, card.requests, card.sectors, card.stalls, card.busy_us / 1000);
+    }
+
+    // Scrubbing: 2000 seeks back and forth over the whole script, each followed by one frame,
+    // with an LRU of 1 KiB blocks in the reader.
+    static const int cache_blocks[] = { 0, 8, 32, 128, 512 };
+
+    printf("\n%7s %12s %8s %8s %8s %9s\n", "scrub", "cache KiB", "loads", "requests", "sectors", "busy ms");
+
+    for (int blocks : cache_blocks)
+    {
+        OSR_FILE_STORAGE file;
+        OSR_SD_STORAGE sd(&file, get_default_sd_profile(), &osr_sim_time_us);
+        osr_sim_time_us = 0;
+
+        OSR_SCRIPT script(path, 128, &sd);
+        configure(script);
+        script.set_clock(get_sim_time_us);
+        script.set_block_cache(blocks, 1024);
+        script.play();
+
+        String tcode;
+        unsigned random = 1;
+        long end = long(script.get_end_time_ms() - osr_sim_time_us / 1000);
+        for (int cnt(0); cnt < 2000 && end > 0; cnt++)
+        {
+            random = random * 1103515245 + 12345;
+            script.seek_ms(long((random >> 8) % end));
+            script.roll(tcode);
+        }
+
+        OSR_IO_STATS io = script.get_io_stats();
+        OSR_SD_STATS card = sd.get_stats();
+        printf("%7s %12d %8llu %8llu %8llu %9llu\n", "", blocks, io.loads, card.requests, card.sectors, card.busy_us / 1000);
+    }
+
+    return 0;
+}
+
+// Plays a script with keyframes on adjacent frames in interval mode, forwards and backwards, on
+// the simulated clock and compares every line sent with what the device must receive.
+static int run_self_check()
+{
+    struct CHECK
+    {
+        const char * name;
+        bool reverse;
+        const char * expected;
+    };
+
+    static const CHECK checks[] = {
+        { "interval forward", false, "L00000 L01000I10 |L07500I740 |" },
+        { "interval backward", true, "L07500 L01000I731 |L00000I10 |" },
+    };
+
+    OSRSB_Header header;
+    memset(&header, 0, sizeof(header));
+    header.frame = 76;
+    header.duration = 750;
+    header.interval = 10;
+    strcpy(header.title, "self check");
+    strcpy(header.version, "V1.0");
+
+    std::vector<OSRSB_Body> body(header.frame);
+    memset(body.data(), -1, body.size() * sizeof(OSRSB_Body));
+    body[0].stroke = 0;
+    body[1].stroke = 10;
+    body[75].stroke = 75;
+
+    std::vector<char> bytes((char*)&header, (char*)&header + sizeof(header));
+    bytes.insert(bytes.end(), (char*)body.data(), (char*)(body.data() + body.size()));
+
+    int failed = 0;
+    for (const CHECK& check : checks)
+    {
+        OSR_MEMORY_STORAGE memory(bytes.data(), long(bytes.size()));
+        osr_sim_time_us = 0;
+
+        OSR_SCRIPT script("self check", 128, &memory);
+        script.set_clock(get_sim_time_us);
+        script.set_output_mode(TCODE_OUTPUT_INTERVAL);
+        if (check.reverse)
+        {
+            script.set_rate(-1000, 1000);
+            script.seek_ms(LONG_MAX);
+        }
+        script.play();
+
+        String tcode, sent;
+        for (int cnt(0); cnt < 1000 && script.roll(tcode) == OSR_SCRIPT::SCRIPT_PLAYING; cnt++)
+        {
+            if (!tcode.empty())
+                sent += tcode + "|";
+            tcode.clear();
+
+            unsigned long long deadline = (unsigned long long)script.get_next_deadline_ms() * 1000;
+            if (deadline > osr_sim_time_us)
+                osr_sim_time_us = deadline;
+        }
+
+        bool ok = sent == check.expected;
+        std::cout << check.name << ": " << (ok ? "ok" : "FAILED") << std::endl;
+        if (!ok)
+        {
+            std::cout << "\texpected: " << check.expected << std::endl;
+            std::cout << "\tsent:     " << sent << std::endl;
+            failed++;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
+
+// Plays the script into a pseudo-terminal through OSR_SERIAL_SINK and reads it back from the
+// master side to measure what a device on the other end of the line would see.
+static int run_pty_loopback(OSR_SCRIPT& script, int baud)
+{
+#ifdef _WIN32
+    std::cerr << "PTY loopback is not supported on this platform." << std::endl;
+    return -1;
+#else
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("Error creating pseudo-terminal");
+        return -1;
+    }
+
+    String slave(ptsname(master));
+    std::cout << "Loopback through: " << slave << std::endl;
+
+    OSR_SERIAL_SINK sink;
+    if (!sink.open(slave, baud))
+    {
+        ::close(master);
+        return -1;
+    }
+
+    std::atomic<bool> done(false);
+    std::vector<unsigned long long> latency;
+    unsigned long long received = 0;
+    unsigned long long first_us = 0, last_us = 0;
+
+    std::thread reader([&]() {
+
+        char data[4096];
+        unsigned long long line = 0;
+
+        while (true)
+        {
+            pollfd pfd = { master, POLLIN, 0 };
+            if (poll(&pfd, 1, 50) <= 0)
+            {
+                if (done)
+                    break;
+                continue;
+            }
+
+            ssize_t count = ::read(master, data, sizeof(data));
+            if (count <= 0)
+                break;
+
+            unsigned long long now = get_curr_time_us();
+            if (!first_us)
+                first_us = now;
+            last_us = now;
+            received += count;
+
+            for (ssize_t cnt(0); cnt < count; cnt++)
+            {
+                if (data[cnt] != '\n')
+                    continue;
+
+                unsigned long long sent = sink.get_line_time(line++);
+                if (sent)
+                    latency.push_back(now - sent);
+            }
+        }
+    });
+
+    OSR_PLAYBACK_ENGINE engine;
+    engine.add(&script, &sink);
+    engine.run();
+
+    while (!sink.flush())
+        Sleep(1);
+
+    Sleep(100);
+    done = true;
+    reader.join();
+    ::close(master);
+
+    OSR_SERIAL_STATS stats = sink.get_stats();
+    std::sort(latency.begin(), latency.end());
+
+    double seconds = last_us > first_us ? (last_us - first_us) / 1e6 : 0;
+    std::cout << "frames: " << stats.frames << "  lines: " << stats.lines << "  coalesced: " << stats.coalesced
+        << "  would block: " << stats.would_block << std::endl;
+    std::cout << "received: " << received << " bytes";
+    if (seconds > 0)
+        std::cout << "  " << (unsigned long long)(received / seconds) << " bytes/s";
+    std::cout << std::endl;
+
+    if (!latency.empty())
+    {
+        std::cout << "latency us  p50: " << latency[latency.size() / 2]
+            << "  p99: " << latency[latency.size() * 99 / 100]
+            << "  max: " << latency.back() << std::endl;
+    }
+
+    return 0;
+#endif
+}
+
+
+int main(int argc, char* argv[])
+{
+    cppcli::Option opt(argc, argv);
+
+    opt.emptyPrintHelpThenExit(false);
+
+    cppcli::Param d_param = opt("-d", "only send axes that changed, with the given dead band");
+    d_param.limitNumRange(0, 99).setDefault(0);
+
+    cppcli::Param i_param = opt("-i", "send one move per keyframe with TCode interval suffix");
+
+    cppcli::Param r_param = opt("-r", "resample output every N ms independent of the file interval");
+    r_param.limitNumRange(0, 10000).setDefault(0);
+
+    cppcli::Param c_param = opt("-c", "use cubic instead of linear interpolation with -r");
+
+    cppcli::Param e_param = opt("-e", "play on N devices at once from a single engine thread");
+    e_param.limitNumRange(1, 10000).setDefault(1);
+
+    cppcli::Param a_param = opt("-a", "with -e, write output from a separate thread through a lock-free queue");
+
+    cppcli::Param p_param = opt("-p", "write TCode to the given serial port instead of the console");
+
+    cppcli::Param b_param = opt("-b", "serial baud rate");
+    b_param.limitOneOf(9600, 19200, 38400, 57600, 115200, 230400).setDefault(115200);
+
+    cppcli::Param t_param = opt("-t", "play through a pseudo-terminal loopback and report bytes/s and latency");
+
+    cppcli::Param l_param = opt("-l", "play every script listed in the given file back to back");
+
+    cppcli::Param o_param = opt("-o", "loop the script endlessly");
+
+    cppcli::Param s_param = opt("-s", "playback rate, e.g. 0.5 for half speed or 2 for double, negative plays backwards from the end");
+    s_param.limitNumRange(-16, 16).setDefault(1);
+
+    cppcli::Param k_param = opt("-k", "latency compensation, emit frames N ms early (negative delays them)");
+    k_param.limitNumRange(-5000, 5000).setDefault(0);
+
+    cppcli::Param m_param = opt("-m", "follow the playback position of mpv through its IPC socket");
+
+    cppcli::Param x_param = opt("-x", "real-time mode: pin the scheduler to CPU N, SCHED_FIFO and locked buffers (Linux)");
+    x_param.limitNumRange(-1, 1023).setDefault(-1);
+
+    cppcli::Param j_param = opt("-j", "report frame lateness, skipped frames and reader I/O counters when playback ends");
+
+    cppcli::Param z_param = opt("-z", "benchmark buffer lengths, prefetch policies and caches against an emulated SD card");
+
+    cppcli::Param v_param = opt("-v", "play through the compile-time player: 1 = stroke only, 4 = L0 R0-R2, 6 = SR6 with L1/L2");
+    v_param.limitOneOf(1, 4, 6).setDefault(4);
+
+    cppcli::Param g_param = opt("-g", "with -e, read the script once through the shared block cache for all devices");
+
+    cppcli::Param y_param = opt("-y", "run the built-in playback checks and exit");
+
+    cppcli::Param h_param = opt("-h", "gain help doc");
+    h_param.setAsHelpParam();
+
+    opt.parse();
+
+    if (y_param.exists())
+        return run_self_check();
+
+    if (argc == 1)
+    {
+        std::cout << "usage: OSRSP.exe path/to/srbs [-d] [-i] [-r] [-c] [-e] [-a] [-p] [-b] [-t] [-l] [-o] [-s] [-k] [-m] [-x] [-j] [-z] [-v] [-g] [-y] " << std::endl;
+        return 0;
+    }
+
+    std::string input_path(argv[1]);
+
+    int rate = s_param.exists() ? int(lround(s_param.getDouble() * 1000)) : 1000;
+    if (!OSR_SCRIPT::is_valid_rate(rate, 1000))
+    {
+        std::cout << "-s = " << s_param.getString() << " is not a valid rate, use 1/16 to 16 times, negative for backwards." << std::endl;
+        return -1;
+    }
+
+    std::cout << "Loading script from: " << input_path << std::endl;
+
+    auto configure = [&](OSR_SCRIPT& script) {
+
+        if (d_param.exists())
+            script.set_output_mode(TCODE_OUTPUT_DELTA, d_param.getInt());
+
+        if (i_param.exists())
+            script.set_output_mode(TCODE_OUTPUT_INTERVAL);
+
+        if (r_param.exists())
+            script.set_output_interval(r_param.getInt(), c_param.exists() ? TCODE_INTERP_CUBIC : TCODE_INTERP_LINEAR);
+
+        if (o_param.exists())
+            script.set_loop(true);
+
+        if (s_param.exists())
+            script.set_rate(rate, 1000);
+
+        if (s_param.exists() && s_param.getDouble() < 0 && !o_param.exists())
+            script.seek_ms(LONG_MAX);
+
+        if (k_param.exists())
+            script.set_latency_offset(k_param.getInt());
+    };
+
+    if (d_param.exists())
+        std::cout << "-d = " << d_param.getString() << std::endl;
+
+    if (i_param.exists())
+        std::cout << "-i" << std::endl;
+
+    if (r_param.exists())
+        std::cout << "-r = " << r_param.getString() << std::endl;
+
+    if (l_param.exists())
+    {
+        std::cout << "-l = " << l_param.getString() << std::endl;
+
+        OSR_PLAYLIST playlist;
+        playlist.set_configure(configure);
+        playlist.set_on_skipped([](OSR_SCRIPT& script) {
+            std::cout << "Script file: " << script.get_file_path() << " is not available." << std::endl;
+        });
+
+        if (j_param.exists())
+            playlist.set_on_finished([](OSR_SCRIPT& script) {
+                print_timing_stats(script.get_file_path(), script.get_timing_stats());
+                print_io_stats(script.get_file_path(), script.get_io_stats());
+            });
+
+        std::ifstream list(l_param.getString());
+        for (String line; std::getline(list, line);)
+            if (!line.empty())
+                playlist.add(line);
+
+        String tcode;
+        playlist.play();
+        while (playlist.roll(tcode))
+        {
+            if (!tcode.empty())
+                std::cout << "[" << playlist.get_index() << ":" << playlist.get_current()->get_pos() << "] Tcode:" << tcode << std::endl;
+            Sleep(1);
+        }
+
+        return 0;
+    }
+
+    if (e_param.exists())
+    {
+        std::cout << "-e = " << e_param.getString() << std::endl;
+
+        int devices = e_param.getInt();
+        std::vector<OSR_SCRIPT*> scripts;
+        std::vector<OSR_SINK*> sinks;
+        std::vector<OSR_SHARED_STORAGE> shared(g_param.exists() ? devices : 0);
+        OSR_PLAYBACK_ENGINE engine;
+
+        if (x_param.exists())
+            engine.set_realtime(x_param.getInt());
+
+        for (int cnt(0); cnt < devices; cnt++)
+        {
+            OSR_SCRIPT* script = new OSR_SCRIPT(input_path, 128, shared.empty() ? nullptr : &shared[cnt]);
+            OSR_SINK* sink = new OSR_STREAM_SINK(std::cout, String("dev") + to_string(cnt));
+            if (a_param.exists())
+                sink = new OSR_ASYNC_SINK(sink);
+            configure(*script);
+
+            if (!engine.add(script, sink))
+                std::cout << "Script file: " << script->get_file_path() << " is not available." << std::endl;
+
+            scripts.push_back(script);
+            sinks.push_back(sink);
+        }
+
+        engine.run();
+        print_realtime_report(engine.get_realtime_report());
+
+        for (int cnt(0); cnt < devices; cnt++)
+        {
+            OSR_ASYNC_SINK* async = dynamic_cast<OSR_ASYNC_SINK*>(sinks[cnt]);
+            if (async)
+            {
+                OSR_PIPE_STATS stats = async->get_stats();
+                OSR_SINK* target = async->get_target();
+                delete async;
+                std::cerr << "dev" << cnt << " produced: " << stats.produced << "  written: " << stats.written
+                    << "  overflow: " << stats.overflow << "  backpressure: " << stats.backpressure
+                    << "  max queue delay: " << stats.max_queue_delay << "ms" << std::endl;
+                sinks[cnt] = target;
+            }
+
+            if (j_param.exists())
+            {
+                print_timing_stats(String("dev") + to_string(cnt), scripts[cnt]->get_timing_stats());
+                print_io_stats(String("dev") + to_string(cnt), scripts[cnt]->get_io_stats());
+            }
+
+            delete scripts[cnt];
+            delete sinks[cnt];
+        }
+
+        if (j_param.exists() && g_param.exists())
+        {
+            OSR_SHARED_CACHE_STATS stats = OSR_SHARED_BLOCK_CACHE::instance().get_stats();
+            std::cerr << "shared cache hits: " << stats.hits << "  misses: " << stats.misses << "  reads: " << stats.reads
+                << "  evictions: " << stats.evictions << std::endl;
+        }
+
+        return 0;
+    }
+
+    if (z_param.exists())
+        return run_storage_benchmark(input_path, configure);
+
+    OSR_SCRIPT osrs(input_path);
+    configure(osrs);
+
+    int baud = b_param.exists() ? b_param.getInt() : 115200;
+
+    if (t_param.exists() || v_param.exists())
+    {
+        if (!osrs.vaildate())
+            return -1;
+
+        int result;
+        if (t_param.exists())
+            result = run_pty_loopback(osrs, baud);
+        else if (v_param.getInt() == 1)
+            result = run_axis_player<OSR_AXES_STROKE>(osrs);
+        else if (v_param.getInt() == 6)
+            result = run_axis_player<OSR_AXES_SR6>(osrs);
+        else
+            result = run_axis_player<OSR_AXES_DEFAULT>(osrs);
+
+        if (j_param.exists())
+        {
+            print_timing_stats(t_param.exists() ? "loopback" : "player", osrs.get_timing_stats());
+            print_io_stats(t_param.exists() ? "loopback" : "player", osrs.get_io_stats());
+        }
+
+        return result;
+    }
+
+    if (m_param.exists())
+    {
+        OSR_MPV_CLOCK clock;
+        OSR_SERIAL_SINK serial;
+        OSR_STREAM_SINK console(std::cout, "sync");
+        OSR_SINK* sink = &console;
+
+        if (!osrs.vaildate() || !clock.open(m_param.getString()))
+            return -1;
+
+        if (p_param.exists())
+        {
+            if (!serial.open(p_param.getString(), baud))
+                return -1;
+            sink = &serial;
+        }
+
+        long master;
+        osrs.play();
+        if (clock.query(master))
+            osrs.seek_ms(master);
+
+        String tcode;
+        unsigned long next_sync = get_curr_time_ms() + 500;
+        while (osrs.roll(tcode))
+        {
+            if (!tcode.empty())
+                sink->write(tcode);
+
+            if (long(get_curr_time_ms() - next_sync) >= 0)
+            {
+                if (clock.query(master))
+                {
+                    long error = master - osrs.get_time_ms();
+                    osrs.sync_to_master(master);
+                    std::cerr << "master: " << master << "ms  error: " << error << "ms  slew: " << osrs.get_sync_ppm() << "ppm" << std::endl;
+                }
+                next_sync += 500;
+            }
+
+            Sleep(1);
+        }
+
+        if (j_param.exists())
+        {
+            print_timing_stats("sync", osrs.get_timing_stats());
+            print_io_stats("sync", osrs.get_io_stats());
+        }
+        return 0;
+    }
+
+    if (p_param.exists())
+    {
+        OSR_SERIAL_SINK sink;
+        if (!osrs.vaildate() || !sink.open(p_param.getString(), baud))
+            return -1;
+
+        OSR_PLAYBACK_ENGINE engine;
+        if (x_param.exists())
+            engine.set_realtime(x_param.getInt());
+        engine.add(&osrs, &sink);
+        engine.run();
+        print_realtime_report(engine.get_realtime_report());
+
+        while (!sink.flush())
+            Sleep(1);
+
+        OSR_SERIAL_STATS stats = sink.get_stats();
+        std::cout << "frames: " << stats.frames << "  lines: " << stats.lines << "  bytes: " << stats.bytes
+            << "  coalesced: " << stats.coalesced << std::endl;
+
+        if (j_param.exists())
+        {
+            print_timing_stats("serial", osrs.get_timing_stats());
+            print_io_stats("serial", osrs.get_io_stats());
+        }
+        return 0;
+    }
+    
+    if(!osrs.vaildate())
+        std::cout << "Script file: " << osrs.get_file_path() << " is not available." << std::endl;
+    else
+    {
+        String tcode;
+
+        std::cout <<"Normal play" << std::endl;
+        osrs.play();
+        for(int cnt(0); cnt < 100 && osrs.roll(tcode); cnt ++)
+        {
+            std::cout << "[" << osrs.get_pos() << "|" << osrs.get_pos() * osrs.get_interval() << "] Tcode:" << tcode << std::endl;
+            Sleep(osrs.get_roll_interval());
+        }
+
+        std::cout << "Normal play 20ms" << std::endl;
+        osrs.set_interval(20);
+        for (int cnt(0); cnt < 100 && osrs.roll(tcode); cnt++)
+        {
+            std::cout << "[" << osrs.get_pos() << "|" << osrs.get_pos() * osrs.get_interval() << "] Tcode:" << tcode << std::endl;
+            Sleep(osrs.get_roll_interval());
+        }
+
+        std::cout << "Pause" << std::endl;
+        osrs.pause();
+        for (int cnt(0); cnt < 100 && osrs.roll(tcode); cnt++)
+        {
+            std::cout << "[" << osrs.get_pos() << "|" << osrs.get_pos() * osrs.get_interval() << "] Tcode:" << tcode << std::endl;
+            Sleep(osrs.get_roll_interval());
+        }
+
+        std::cout << "Normal play 1000ms" << std::endl;
+        osrs.set_interval(1000);
+        osrs.play();
+        for (int cnt(0); cnt < 10 && osrs.roll(tcode); cnt++)
+        {
+            std::cout << "[" << osrs.get_pos() << "|" << osrs.get_pos() * osrs.get_interval() << "] Tcode:" << tcode << std::endl;
+            Sleep(osrs.get_roll_interval());
+        }
+
+        std::cout << "Normal play 100ms" << std::endl;
+        osrs.set_pos(0);
+        osrs.set_interval(100);
+        osrs.play();
+        while(osrs.roll(tcode))
+        {
+            std::cout << "[" << osrs.get_pos() << "|" << osrs.get_pos() * osrs.get_interval() << "] Tcode:" << tcode << std::endl;
+            Sleep(osrs.get_roll_interval());
+        }
+
+        if (j_param.exists())
+        {
+            print_timing_stats("demo", osrs.get_timing_stats());
+            print_io_stats("demo", osrs.get_io_stats());
         }
 
         osrs.rewind();
@@ -0,0 +1,702 @@
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#error "OSRVE needs POSIX pseudo-terminals and sockets"
+#endif
+
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include "json.hpp"
+#include "cppcli.hpp"
+
+#define SAMPLE_PERIOD_MS_DEFAULT 5
+#define SPEED_LIMIT_DEFAULT 400     // % of full travel per second
+#define IDLE_TIMEOUT_MS_DEFAULT 3000
+#define FRAME_INTERVAL_MS_DEFAULT 100  // OSRST -v
+#define TCODE_RANGE 10000
+
+using json = nlohmann::json;
+
+typedef enum _OSRVE_AXIS_
+{
+    OSRVE_AXIS_L0,
+    OSRVE_AXIS_R0,
+    OSRVE_AXIS_R1,
+    OSRVE_AXIS_R2,
+    OSRVE_AXIS_COUNT,
+}OSRVE_AXIS;
+
+static const char* OSRVE_AXIS_NAME[OSRVE_AXIS_COUNT] = { "L0", "R0", "R1", "R2" };
+
+static inline double get_curr_time_ms()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// A move starts from wherever the axis is when the command arrives and never exceeds the speed limit.
+struct OSRVE_Motion
+{
+    double start_time;
+    double duration;
+    double from;
+    double to;
+
+    double position(double now) const
+    {
+        if (duration <= 0 || now >= start_time + duration)
+            return to;
+        if (now <= start_time)
+            return from;
+        return from + (to - from) * (now - start_time) / duration;
+    }
+};
+
+struct OSRVE_Command
+{
+    double time;
+    int axis;
+    double target;
+    int interval;
+};
+
+struct OSRVE_Sample
+{
+    double time;
+    double pos[OSRVE_AXIS_COUNT];
+};
+
+class OSRVE_DEVICE
+{
+    OSRVE_Motion _motion[OSRVE_AXIS_COUNT];
+    double _speed_limit;    // units per ms
+
+public:
+    std::vector<OSRVE_Command> commands;
+    std::vector<OSRVE_Sample> samples;
+    unsigned long long bytes;
+    unsigned long long errors;
+
+    OSRVE_DEVICE(double speed_limit_percent)
+    {
+        _speed_limit = speed_limit_percent / 100.0 * TCODE_RANGE / 1000.0;
+        bytes = 0;
+        errors = 0;
+
+        for (int axis(0); axis < OSRVE_AXIS_COUNT; axis++)
+            _motion[axis] = { 0, 0, TCODE_RANGE / 2, TCODE_RANGE / 2 };
+    }
+
+    // One TCode token such as L09000, L05I350 or R2750S20, the digits are a fraction of full travel.
+    bool parse_token(const std::string& token, double now)
+    {
+        if (token.size() < 3)
+            return false;
+
+        int axis = -1;
+        for (int cnt(0); cnt < OSRVE_AXIS_COUNT; cnt++)
+            if (token.compare(0, 2, OSRVE_AXIS_NAME[cnt]) == 0)
+                axis = cnt;
+
+        if (axis < 0)
+            return false;
+
+        size_t pos = 2;
+        double value = 0, scale = TCODE_RANGE / 10.0;
+        while (pos < token.size() && isdigit((unsigned char)token[pos]))
+        {
+            value += (token[pos] - '0') * scale;
+            scale /= 10;
+            pos++;
+        }
+
+        if (pos == 2)
+            return false;
+
+        int interval = 0, speed = 0;
+        if (pos < token.size() && (token[pos] == 'I' || token[pos] == 'S'))
+        {
+            char type = token[pos];
+            int arg = atoi(token.c_str() + pos + 1);
+            if (type == 'I')
+                interval = arg;
+            else
+                speed = arg;
+        }
+
+        OSRVE_Motion& motion = _motion[axis];
+        double from = motion.position(now);
+        double distance = fabs(value - from);
+
+        double duration = interval;
+        if (speed > 0)
+            duration = std::max(duration, distance / (speed * TCODE_RANGE / 100.0 / 100.0));
+        duration = std::max(duration, distance / _speed_limit);
+
+        motion = { now, duration, from, value };
+        commands.push_back({ now, axis, value, interval });
+        return true;
+    }
+
+    void parse_line(const std::string& line, double now)
+    {
+        size_t pos = 0;
+        while (pos < line.size())
+        {
+            size_t end = line.find(' ', pos);
+            if (end == std::string::npos)
+                end = line.size();
+
+            std::string token = line.substr(pos, end - pos);
+            if (!token.empty() && !parse_token(token, now))
+                errors++;
+
+            pos = end + 1;
+        }
+    }
+
+    void sample(double now)
+    {
+        OSRVE_Sample s;
+        s.time = now;
+        for (int axis(0); axis < OSRVE_AXIS_COUNT; axis++)
+            s.pos[axis] = _motion[axis].position(now);
+        samples.push_back(s);
+    }
+};
+
+// Keyframes of the reference funscript in ms and fraction of full travel.
+static bool load_reference(const std::string& path, std::vector<std::pair<double, double>>& out)
+{
+    try
+    {
+        std::ifstream f(path);
+        json j = json::parse(f);
+        json actions = j["actions"];
+
+        double max_pos = 0;
+        for (auto& item : actions)
+            max_pos = std::max(max_pos, double(item["pos"]));
+
+        for (auto& item : actions)
+            out.push_back({ double(item["at"]), max_pos > 0 ? double(item["pos"]) / max_pos : 0 });
+
+        std::sort(out.begin(), out.end());
+        return !out.empty();
+    }
+    catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+}
+
+static double reference_position(const std::vector<std::pair<double, double>>& ref, double at)
+{
+    auto it = std::lower_bound(ref.begin(), ref.end(), std::make_pair(at, -1.0));
+    if (it == ref.begin())
+        return it->second;
+    if (it == ref.end())
+        return ref.back().second;
+
+    auto prev = it - 1;
+    double span = it->first - prev->first;
+    return span > 0 ? prev->second + (it->second - prev->second) * (at - prev->first) / span : it->second;
+}
+
+// OSRST moves every action to the start of the frame it falls in, that is when the player sends it.
+static double frame_time(double at, int frame_interval)
+{
+    return frame_interval > 0 ? ceil(at / frame_interval) * frame_interval : at;
+}
+
+// t0 is the wall clock time of script time 0.
+static double tracking_rms(const OSRVE_DEVICE& device, const std::vector<std::pair<double, double>>& ref,
+    double t0, double lag, double* max_error)
+{
+    double sum = 0, worst = 0;
+    size_t count = 0;
+
+    for (const OSRVE_Sample& s : device.samples)
+    {
+        double at = s.time - t0 - lag;
+        if (at < ref.front().first || at > ref.back().first)
+            continue;
+
+        double error = (s.pos[OSRVE_AXIS_L0] / TCODE_RANGE - reference_position(ref, at)) * 100;
+        sum += error * error;
+        worst = std::max(worst, fabs(error));
+        count++;
+    }
+
+    if (max_error)
+        *max_error = worst;
+    return count ? sqrt(sum / count) : -1;
+}
+
+#define LAG_SEARCH_MS 2000
+
+struct OSRVE_Result
+{
+    size_t measured;        // commands with a known send time
+    double jitter_rms;      // ms, arrival minus scheduled send time
+    double jitter_max;
+    bool locked;            // the latency search found a minimum inside its range
+    double latency;
+    double rms_zero, max_zero;
+    double rms_best, max_best;
+};
+
+// Every stroke command is aimed at a keyframe. The first one anchors the reference: a move with
+// an I suffix reaches its keyframe I ms after it arrives, one without is sent on the keyframe.
+// A move with an I suffix is due once the previous one has reached its target, any other command
+// is due on the frame of the keyframe it sends the device to. A resampled stream, more commands
+// than keyframes, is due on a grid of its own and left out.
+static bool analyse(const OSRVE_DEVICE& device, const std::vector<std::pair<double, double>>& ref,
+    int frame_interval, OSRVE_Result& result)
+{
+    memset(&result, 0, sizeof(result));
+
+    const OSRVE_Command* first = nullptr;
+    for (const OSRVE_Command& cmd : device.commands)
+        if (cmd.axis == OSRVE_AXIS_L0)
+        {
+            first = &cmd;
+            break;
+        }
+
+    if (!first)
+        return false;
+
+    double t0 = ref.empty() ? first->time : first->time + first->interval - frame_time(ref.front().first, frame_interval);
+    double window = frame_interval > 0 ? frame_interval : 50;
+
+    size_t plain = 0;
+    for (const OSRVE_Command& cmd : device.commands)
+        if (cmd.axis == OSRVE_AXIS_L0 && cmd.interval == 0)
+            plain++;
+    bool resampled = plain > ref.size();
+
+    std::vector<double> chained, keyed;
+    const OSRVE_Command* prev = nullptr;
+    for (const OSRVE_Command& cmd : device.commands)
+    {
+        if (cmd.axis != OSRVE_AXIS_L0)
+            continue;
+
+        if (cmd.interval > 0)
+        {
+            if (prev)
+                chained.push_back(cmd.time - (prev->time + prev->interval));
+        }
+        else if (!resampled)
+        {
+            // The keyframe nearest the arrival that OSRST stored as the same whole percent.
+            double at = cmd.time - t0, late = 0;
+            bool known = false;
+            for (const std::pair<double, double>& key : ref)
+            {
+                double due = frame_time(key.first, frame_interval);
+                int pos = std::min(99, int(key.second * 100 + 1e-4));
+                if (pos != int(cmd.target / 100 + 0.5) || fabs(at - due) > window)
+                    continue;
+                if (!known || fabs(at - due) < fabs(late))
+                    late = at - due;
+                known = true;
+            }
+            if (known)
+                keyed.push_back(late);
+        }
+        prev = &cmd;
+    }
+
+    double sum = 0;
+    for (const std::vector<double>* lateness : { &chained, &keyed })
+        for (double late : *lateness)
+        {
+            sum += late * late;
+            result.jitter_max = std::max(result.jitter_max, fabs(late));
+            result.measured++;
+        }
+
+    if (result.measured)
+        result.jitter_rms = sqrt(sum / result.measured);
+
+    if (ref.empty())
+        return true;
+
+    // Latency is the shift of the reference that best explains the modelled stroke.
+    double best_rms = -1;
+    for (double lag = -LAG_SEARCH_MS; lag <= LAG_SEARCH_MS; lag += 1)
+    {
+        double rms = tracking_rms(device, ref, t0, lag, nullptr);
+        if (rms >= 0 && (best_rms < 0 || rms < best_rms))
+        {
+            best_rms = rms;
+            result.latency = lag;
+        }
+    }
+
+    result.locked = best_rms >= 0 && fabs(result.latency) < LAG_SEARCH_MS;
+    result.rms_best = best_rms;
+    result.rms_zero = tracking_rms(device, ref, t0, 0, &result.max_zero);
+    tracking_rms(device, ref, t0, result.latency, &result.max_best);
+    return true;
+}
+
+static void report(const OSRVE_DEVICE& device, const std::vector<std::pair<double, double>>& ref, int frame_interval)
+{
+    std::cout << std::endl << "bytes: " << device.bytes << "  commands: " << device.commands.size()
+        << "  parse errors: " << device.errors << std::endl;
+
+    OSRVE_Result result;
+    if (!analyse(device, ref, frame_interval, result))
+        return;
+
+    if (result.measured)
+        std::cout << "send lateness rms: " << result.jitter_rms << "ms  max: " << result.jitter_max
+            << "ms  (" << result.measured << " stroke commands)" << std::endl;
+    else
+        std::cout << "send lateness: no stroke command with a known send time" << std::endl;
+
+    if (ref.empty())
+        return;
+
+    if (!result.locked)
+    {
+        std::cout << "latency: beyond +-" << LAG_SEARCH_MS << "ms, the stroke does not follow the reference" << std::endl;
+        std::cout << "tracking error %  rms: " << result.rms_zero << "  max: " << result.max_zero << std::endl;
+        return;
+    }
+
+    std::cout << "latency: " << result.latency << "ms" << std::endl;
+    std::cout << "tracking error %  rms: " << result.rms_zero << "  max: " << result.max_zero
+        << "  (after latency rms: " << result.rms_best << "  max: " << result.max_best << ")" << std::endl;
+}
+
+// Plays a generated script the way OSRSP does, on keyframes or one interval move per keyframe,
+// into a device without a speed limit. The script starts at offset ms, from the middle where the
+// device rests, so every offset has to give the same report.
+static bool self_test_case(double offset, bool interval_mode, int frame_interval, OSRVE_Result& result)
+{
+    std::vector<std::pair<double, double>> ref;
+    unsigned seed = 7;
+    double at = offset;
+    for (int cnt(0); cnt < 80; cnt++)
+    {
+        seed = seed * 1103515245 + 12345;
+        ref.push_back({ at, cnt == 0 ? 0.5 : (cnt % 2 ? 60 + (seed >> 16) % 40 : (seed >> 16) % 40) / 100.0 });
+        at += frame_interval * (3 + (seed >> 8) % 40);
+    }
+
+    OSRVE_DEVICE device(1e6);
+    double start = 5000, last = start, previous = 0;
+    char token[32];
+
+    for (size_t cnt(0); cnt < ref.size(); cnt++)
+    {
+        double due = frame_time(ref[cnt].first, frame_interval);
+        double send = interval_mode ? previous : due;
+        int pos = int(ref[cnt].second * 100 + 0.5);
+
+        for (; last < start + send; last += 5)
+            device.sample(last);
+
+        if (interval_mode && due > send)
+            snprintf(token, sizeof(token), "L0%04dI%d", pos * 100, int(due - send));
+        else
+            snprintf(token, sizeof(token), "L0%04d", pos * 100);
+        device.parse_line(token, start + send);
+        previous = due;
+    }
+
+    for (; last < start + previous + 500; last += 5)
+        device.sample(last);
+
+    return analyse(device, ref, frame_interval, result);
+}
+
+static int self_test()
+{
+    bool passed = true;
+    for (int interval_mode(0); interval_mode < 2; interval_mode++)
+    {
+        OSRVE_Result base;
+        for (double offset : { 0.0, 1000.0, 3210.0 })
+        {
+            OSRVE_Result result;
+            bool ok = self_test_case(offset, interval_mode != 0, 10, result) && result.locked
+                && result.measured > 0 && result.jitter_max < 0.5;
+
+            // Keyframe mode jumps ahead of the reference, interval mode follows it exactly.
+            if (offset == 0)
+                base = result;
+            ok = ok && fabs(result.latency - base.latency) <= 10 && fabs(result.rms_zero - base.rms_zero) < 0.5
+                && (!interval_mode || (fabs(result.latency) <= 10 && result.rms_zero < 1));
+
+            std::cout << (ok ? "PASS" : "FAIL") << (interval_mode ? "  interval" : "  keyframe")
+                << "  first action " << offset << "ms  latency: " << result.latency << "ms  send lateness max: "
+                << result.jitter_max << "ms  tracking rms: " << result.rms_zero << std::endl;
+            passed = passed && ok;
+        }
+    }
+
+    return passed ? 0 : -1;
+}
+
+static int open_unix_socket(const std::string& path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("Error creating socket");
+        return -1;
+    }
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());
+
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 1) != 0) {
+        perror((std::string("Error listening on: ") + path).c_str());
+        close(fd);
+        return -1;
+    }
+
+    std::cout << "Listening on: " << path << std::endl;
+    return fd;
+}
+
+static int open_pty(std::string& out_slave, int& out_slave_fd)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("Error creating pseudo-terminal");
+        return -1;
+    }
+
+    out_slave = ptsname(master);
+
+    // Holding the slave open keeps the master readable between player connections.
+    out_slave_fd = open(out_slave.c_str(), O_RDWR | O_NOCTTY);
+    termios tio;
+    if (out_slave_fd >= 0 && tcgetattr(out_slave_fd, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        tcsetattr(out_slave_fd, TCSANOW, &tio);
+    }
+
+    std::cout << "Device: " << out_slave << std::endl;
+    return master;
+}
+
+static pid_t spawn_player(std::string command, const std::string& device)
+{
+    size_t pos;
+    while ((pos = command.find("{}")) != std::string::npos)
+        command.replace(pos, 2, device);
+
+    std::cout << "Player: " << command << std::endl;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        execl("/bin/sh", "sh", "-c", command.c_str(), (char*)nullptr);
+        _exit(127);
+    }
+
+    return pid;
+}
+
+
+int main(int argc, char* argv[])
+{
+    cppcli::Option opt(argc, argv);
+
+    opt.emptyPrintHelpThenExit(false);
+
+    cppcli::Param u_param = opt("-u", "listen on a UNIX socket instead of a pseudo-terminal");
+
+    cppcli::Param s_param = opt("-s", "speed limit in % of full travel per second");
+    s_param.limitNumRange(1, 100000).setDefault(SPEED_LIMIT_DEFAULT);
+
+    cppcli::Param p_param = opt("-p", "position sample period in ms");
+    p_param.limitNumRange(1, 1000).setDefault(SAMPLE_PERIOD_MS_DEFAULT);
+
+    cppcli::Param q_param = opt("-q", "stop after N ms without input");
+    q_param.limitNumRange(100, 600000).setDefault(IDLE_TIMEOUT_MS_DEFAULT);
+
+    cppcli::Param r_param = opt("-r", "reference funscript for latency and tracking error");
+
+    cppcli::Param o_param = opt("-o", "write the sampled positions to a csv file");
+
+    cppcli::Param x_param = opt("-x", "player command to run against the device, {} is replaced by its path");
+
+    cppcli::Param v_param = opt("-v", "frame interval in ms the script was converted with (OSRST -v)");
+    v_param.limitNumRange(1, 10000).setDefault(FRAME_INTERVAL_MS_DEFAULT);
+
+    cppcli::Param t_param = opt("-t", "check the report against an ideal player and exit");
+
+    cppcli::Param h_param = opt("-h", "gain help doc");
+    h_param.setAsHelpParam();
+
+    opt.parse();
+
+    double speed_limit = s_param.exists() ? s_param.getDouble() : SPEED_LIMIT_DEFAULT;
+    int sample_period = p_param.exists() ? p_param.getInt() : SAMPLE_PERIOD_MS_DEFAULT;
+    int idle_timeout = q_param.exists() ? q_param.getInt() : IDLE_TIMEOUT_MS_DEFAULT;
+    int frame_interval = v_param.exists() ? v_param.getInt() : FRAME_INTERVAL_MS_DEFAULT;
+
+    if (t_param.exists())
+        return self_test();
+
+    std::vector<std::pair<double, double>> reference;
+    if (r_param.exists() && !load_reference(r_param.getString(), reference))
+    {
+        std::cerr << "Failed to load reference: " << r_param.getString() << std::endl;
+        return -1;
+    }
+
+    std::string device_path;
+    int listen_fd = -1, slave_fd = -1, fd;
+
+    if (u_param.exists())
+    {
+        device_path = u_param.getString();
+        fd = listen_fd = open_unix_socket(device_path);
+    }
+    else
+        fd = open_pty(device_path, slave_fd);
+
+    if (fd < 0)
+        return -1;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    pid_t player = x_param.exists() ? spawn_player(x_param.getString(), device_path) : -1;
+
+    OSRVE_DEVICE device(speed_limit);
+    std::string line;
+    double last_input = -1, next_sample = get_curr_time_ms();
+    bool player_done = player < 0;
+
+    while (true)
+    {
+        double now = get_curr_time_ms();
+
+        if (!player_done && waitpid(player, nullptr, WNOHANG) == player)
+        {
+            player_done = true;
+            last_input = std::min(last_input < 0 ? now : last_input, now - idle_timeout + 200);
+        }
+
+        if (last_input >= 0 && now - last_input > idle_timeout && player_done)
+            break;
+
+        int timeout = int(std::max(0.0, next_sample - now));
+        pollfd pfd = { fd, POLLIN, 0 };
+
+        if (poll(&pfd, 1, timeout) > 0)
+        {
+            if (fd == listen_fd)
+            {
+                fd = accept(listen_fd, nullptr, nullptr);
+                if (fd < 0)
+                    fd = listen_fd;
+                continue;
+            }
+
+            char data[1024];
+            ssize_t count = read(fd, data, sizeof(data));
+            now = get_curr_time_ms();
+
+            if (count <= 0)
+            {
+                if (listen_fd >= 0 && fd != listen_fd)
+                {
+                    close(fd);
+                    fd = listen_fd;
+                }
+                if (last_input >= 0 && player_done)
+                    break;
+                continue;
+            }
+
+            device.bytes += count;
+            last_input = now;
+
+            for (ssize_t cnt(0); cnt < count; cnt++)
+            {
+                if (data[cnt] == '\n' || data[cnt] == '\r')
+                {
+                    device.parse_line(line, now);
+                    line.clear();
+                }
+                else
+                    line += data[cnt];
+            }
+        }
+
+        if (now >= next_sample)
+        {
+            if (last_input >= 0)
+                device.sample(now);
+            next_sample += sample_period;
+            if (next_sample < now)
+                next_sample = now + sample_period;
+        }
+    }
+
+    if (player > 0 && !player_done)
+    {
+        kill(player, SIGTERM);
+        waitpid(player, nullptr, 0);
+    }
+
+    if (o_param.exists())
+    {
+        std::ofstream csv(o_param.getString());
+        csv << "ms,L0,R0,R1,R2" << std::endl;
+        double t0 = device.samples.empty() ? 0 : device.samples.front().time;
+        for (const OSRVE_Sample& s : device.samples)
+        {
+            csv << long(s.time - t0);
+            for (int axis(0); axis < OSRVE_AXIS_COUNT; axis++)
+                csv << "," << long(s.pos[axis]);
+            csv << std::endl;
+        }
+    }
+
+    report(device, reference, frame_interval);
+
+    if (fd >= 0 && fd != listen_fd)
+        close(fd);
+    if (listen_fd >= 0)
+    {
+        close(listen_fd);
+        unlink(device_path.c_str());
+    }
+    if (slave_fd >= 0)
+        close(slave_fd);
+
+    return 0;
+}